@@ -5,19 +5,24 @@ extern "C" {
 #endif
 
 #include "CustomAssert.h"
+#include "OffsetAllocator.h"
 
 #include <stdint.h>
+#include <vulkan/vulkan.h>
 
+//buddy allocator, allocations are rounded up to a power of two number of blocks
+//hands out memory of a preallocated buffer, the buddy bookkeeping is done by an OffsetAllocator
 typedef struct ConsecutivePoolAllocator
 {
 	char* buf; //preallocated buffer
-	uint32_t* nextFreeBlock;
+	OffsetAllocator oa; //blocks of buf
 	unsigned blockSize;
 	unsigned size; //size is exact multiple of block size
+	unsigned numBlocks;
 } ConsecutivePoolAllocator;
 
-ConsecutivePoolAllocator createConsecutivePoolAllocator(char* b, unsigned bs, unsigned s);
-void destroyConsecutivePoolAllocator(ConsecutivePoolAllocator* pa);
+ConsecutivePoolAllocator createConsecutivePoolAllocator(char* b, unsigned bs, unsigned s, const VkAllocationCallbacks* pAllocator);
+void destroyConsecutivePoolAllocator(ConsecutivePoolAllocator* pa, const VkAllocationCallbacks* pAllocator);
 void* consecutivePoolAllocate(ConsecutivePoolAllocator* pa, uint32_t numBlocks);
 void consecutivePoolFree(ConsecutivePoolAllocator* pa, void* p, uint32_t numBlocks);
 void* consecutivePoolReAllocate(ConsecutivePoolAllocator* pa, void* currentMem, uint32_t currNumBlocks);
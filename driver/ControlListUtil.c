@@ -41,6 +41,51 @@ void clInit(ControlList* cl, void* buffer)
 	cl->buffer = buffer;
 	cl->numBlocks = 1;
 	cl->nextFreeByte = &cl->buffer[0];
+	cl->firstChunk = 0;
+	cl->currentChunk = 0;
+}
+
+//numBlocks is the size of the chunk including its header
+//a null chunk leaves the list without memory, so allocation failures can be checked on buffer
+void clInitChunked(ControlList* cl, void* chunk, uint32_t numBlocks)
+{
+	assert(cl);
+	ControlListChunk* c = chunk;
+	cl->firstChunk = c;
+	cl->currentChunk = c;
+	cl->buffer = c ? (uint8_t*)(c + 1) : 0;
+	cl->numBlocks = numBlocks;
+	cl->nextFreeByte = cl->buffer;
+
+	if(c)
+	{
+		c->next = 0;
+		c->numBlocks = numBlocks;
+		c->size = 0;
+	}
+}
+
+//close the current chunk and continue recording into the given one, chunk->numBlocks must be set
+void clStartChunk(ControlList* cl, ControlListChunk* chunk)
+{
+	assert(cl);
+	assert(cl->currentChunk);
+	assert(chunk);
+	cl->currentChunk->size = clSize(cl);
+	cl->currentChunk->next = chunk;
+	chunk->next = 0;
+	chunk->size = 0;
+	cl->currentChunk = chunk;
+	cl->buffer = (uint8_t*)(chunk + 1);
+	cl->numBlocks = chunk->numBlocks;
+	cl->nextFreeByte = cl->buffer;
+}
+
+void clInitHandleHash(ControlListHandleHash* hash)
+{
+	assert(hash);
+	memset(hash->slots, 0, sizeof(hash->slots));
+	hash->numEntries = 0;
 }
 
 void clInsertUniformConstant(ControlList* cl, uint32_t data)
@@ -638,6 +683,7 @@ void clInsertGEMRelocations(ControlList* cl,
 void clInsertShaderRecord(ControlList* cls,
 						  ControlList* relocCl,
 						  ControlList* handlesCl,
+						  ControlListHandleHash* handlesHash,
 						  uint32_t fragmentShaderIsSingleThreaded, //0/1
 						  uint32_t pointSizeIncludedInShadedVertexData, //0/1
 						  uint32_t enableClipping, //0/1
@@ -667,14 +713,14 @@ void clInsertShaderRecord(ControlList* cls,
 	*cls->nextFreeByte = 0; cls->nextFreeByte++;
 	*(uint16_t*)cls->nextFreeByte = moveBits(fragmentNumberOfUnusedUniforms, 16, 0); cls->nextFreeByte++;
 	*cls->nextFreeByte |= fragmentNumberOfVaryings; cls->nextFreeByte++;
-	clEmitShaderRelocation(relocCl, handlesCl, &fragmentCodeAddress);
+	clEmitShaderRelocation(relocCl, handlesCl, handlesHash, &fragmentCodeAddress);
 	*(uint32_t*)cls->nextFreeByte = fragmentCodeAddress.offset; cls->nextFreeByte += 4;
 	*(uint32_t*)cls->nextFreeByte = fragmentUniformsAddress; cls->nextFreeByte += 4;
 
 	*(uint16_t*)cls->nextFreeByte = moveBits(vertexNumberOfUnusedUniforms, 16, 0); cls->nextFreeByte += 2;
 	*cls->nextFreeByte = vertexAttributeArraySelectBits; cls->nextFreeByte++;
 	*cls->nextFreeByte = vertexTotalAttributesSize; cls->nextFreeByte++;
-	clEmitShaderRelocation(relocCl, handlesCl, &vertexCodeAddress);
+	clEmitShaderRelocation(relocCl, handlesCl, handlesHash, &vertexCodeAddress);
 	//TODO wtf???
 	uint32_t offset = moveBits(vertexCodeAddress.offset, 32, 0) | moveBits(vertexUniformsAddress, 32, 0);
 	*(uint32_t*)cls->nextFreeByte = offset; cls->nextFreeByte += 4;
@@ -683,7 +729,7 @@ void clInsertShaderRecord(ControlList* cls,
 	*(uint16_t*)cls->nextFreeByte = moveBits(coordinateNumberOfUnusedUniforms, 16, 0); cls->nextFreeByte += 2;
 	*cls->nextFreeByte = coordinateAttributeArraySelectBits; cls->nextFreeByte++;
 	*cls->nextFreeByte = coordinateTotalAttributesSize; cls->nextFreeByte++;
-	clEmitShaderRelocation(relocCl, handlesCl, &coordinateCodeAddress);
+	clEmitShaderRelocation(relocCl, handlesCl, handlesHash, &coordinateCodeAddress);
 	*(uint32_t*)cls->nextFreeByte = coordinateCodeAddress.offset; cls->nextFreeByte += 4;
 	*(uint32_t*)cls->nextFreeByte = coordinateUniformsAddress; cls->nextFreeByte += 4;
 }
@@ -692,6 +738,7 @@ void clInsertShaderRecord(ControlList* cls,
 void clInsertAttributeRecord(ControlList* cls,
 							 ControlList* relocCl,
 							 ControlList* handlesCl,
+							 ControlListHandleHash* handlesHash,
 						  ControlListAddress address,
 						  uint32_t sizeBytes,
 						  uint32_t stride,
@@ -703,7 +750,7 @@ void clInsertAttributeRecord(ControlList* cls,
 	assert(cls->nextFreeByte);
 	uint32_t sizeBytesMinusOne = sizeBytes - 1;
 	//TODO is this correct?
-	clEmitShaderRelocation(relocCl, handlesCl, &address);
+	clEmitShaderRelocation(relocCl, handlesCl, handlesHash, &address);
 	*(uint32_t*)cls->nextFreeByte = address.offset; cls->nextFreeByte += 4;
 	*cls->nextFreeByte = sizeBytesMinusOne; cls->nextFreeByte++;
 	*cls->nextFreeByte = stride; cls->nextFreeByte++;
@@ -711,15 +758,43 @@ void clInsertAttributeRecord(ControlList* cls,
 	*cls->nextFreeByte = coordinateVPMOffset; cls->nextFreeByte++;
 }
 
-uint32_t clGetHandleIndex(ControlList* handlesCl, uint32_t handle)
+static uint32_t clHashHandle(uint32_t handle)
 {
-	uint32_t c = 0;
+	//GEM handles are small consecutive integers, spread them over the table
+	return (handle * 2654435761u) >> (32 - CONTROL_LIST_HANDLE_HASH_BITS);
+}
 
+uint32_t clGetHandleIndex(ControlList* handlesCl, ControlListHandleHash* handlesHash, uint32_t handle)
+{
+	assert(handlesCl);
+	assert(handlesHash);
+
+	uint32_t* handles = (uint32_t*)handlesCl->buffer;
 	uint32_t numHandles = clSize(handlesCl) / 4;
 
+	uint32_t slot = clHashHandle(handle);
+	for(;;)
+	{
+		uint32_t entry = handlesHash->slots[slot];
+		if(!entry)
+		{
+			break;
+		}
+
+		if(handles[entry - 1] == handle)
+		{
+			//found
+			return entry - 1;
+		}
+
+		slot = (slot + 1) & (CONTROL_LIST_HANDLE_HASH_SIZE - 1);
+	}
+
+	//hash is full, handles past the hashed ones need to be scanned
+	uint32_t c = handlesHash->numEntries;
 	for(; c < numHandles; ++c)
 	{
-		if(((uint32_t*)handlesCl->buffer)[c] == handle)
+		if(handles[c] == handle)
 		{
 			//found
 			return c;
@@ -730,11 +805,17 @@ uint32_t clGetHandleIndex(ControlList* handlesCl, uint32_t handle)
 	*(uint32_t*)handlesCl->nextFreeByte = handle;
 	handlesCl->nextFreeByte += 4;
 
+	if(handlesHash->numEntries == c && c < CONTROL_LIST_HANDLE_HASH_MAX_ENTRIES)
+	{
+		handlesHash->slots[slot] = c + 1;
+		handlesHash->numEntries++;
+	}
+
 	return c;
 }
 
 //input: 2 cls (cl + handles cl)
-inline void clEmitShaderRelocation(ControlList* relocCl, ControlList* handlesCl, const ControlListAddress* address)
+inline void clEmitShaderRelocation(ControlList* relocCl, ControlList* handlesCl, ControlListHandleHash* handlesHash, const ControlListAddress* address)
 {
 	assert(relocCl);
 	assert(relocCl->buffer);
@@ -746,7 +827,7 @@ inline void clEmitShaderRelocation(ControlList* relocCl, ControlList* handlesCl,
 	assert(address->handle);
 
 	//store offset within handles in cl
-	*(uint32_t*)relocCl->nextFreeByte = clGetHandleIndex(handlesCl, address->handle);
+	*(uint32_t*)relocCl->nextFreeByte = clGetHandleIndex(handlesCl, handlesHash, address->handle);
 	relocCl->nextFreeByte += 4;
 }
 
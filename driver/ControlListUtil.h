@@ -14,14 +14,42 @@ typedef struct ControlListAddress
 
 #define CONTROL_LIST_SIZE 4096
 
+//header at the start of each chunk of a chunked control list
+typedef struct ControlListChunk
+{
+	struct ControlListChunk* next;
+	uint32_t numBlocks; //size of the chunk including this header
+	uint32_t size; //bytes of commands in the chunk, valid once a following chunk was started
+} ControlListChunk;
+
+//chunks start at one block and double up to this
+#define CONTROL_LIST_MAX_CHUNK_BLOCKS 16
+
 typedef struct ControlList
 {
 	uint8_t* buffer; //TODO size?
 	uint32_t numBlocks;
 	uint8_t* nextFreeByte; //pointer to the next available free byte
+	//for chunked lists buffer and numBlocks describe the current chunk
+	//the first chunk is kept across resets, currentChunk is 0 once the list was flattened
+	ControlListChunk* firstChunk;
+	ControlListChunk* currentChunk;
 } ControlList;
 
-void clEmitShaderRelocation(ControlList* relocCl, ControlList* handlesCl, const ControlListAddress* address);
+//number of slots in the BO handle hash
+#define CONTROL_LIST_HANDLE_HASH_BITS 10
+#define CONTROL_LIST_HANDLE_HASH_SIZE (1 << CONTROL_LIST_HANDLE_HASH_BITS)
+//handles beyond this many are looked up with a linear scan
+#define CONTROL_LIST_HANDLE_HASH_MAX_ENTRIES (CONTROL_LIST_HANDLE_HASH_SIZE * 3 / 4)
+
+//open addressing hash mapping BO handles to their index in a handles CL
+typedef struct ControlListHandleHash
+{
+	uint16_t slots[CONTROL_LIST_HANDLE_HASH_SIZE]; //index in the handles CL + 1, 0 if empty
+	uint32_t numEntries; //the first numEntries handles of the handles CL are in the hash
+} ControlListHandleHash;
+
+void clEmitShaderRelocation(ControlList* relocCl, ControlList* handlesCl, ControlListHandleHash* handlesHash, const ControlListAddress* address);
 void clDummyRelocation(ControlList* relocCl, const ControlListAddress* address);
 
 #define __gen_user_data struct ControlList
@@ -38,6 +66,9 @@ uint32_t moveBits(uint32_t d, uint32_t bits, uint32_t offset);
 uint32_t clSize(ControlList* cl);
 uint32_t clHasEnoughSpace(ControlList* cl, uint32_t size);
 void clInit(ControlList* cl, void* buffer);
+void clInitChunked(ControlList* cl, void* chunk, uint32_t numBlocks);
+void clStartChunk(ControlList* cl, ControlListChunk* chunk);
+void clInitHandleHash(ControlListHandleHash* hash);
 void clInsertUniformConstant(ControlList* cl, uint32_t data);
 void clInsertUniformXYScale(ControlList* cl, float data);
 void clInsertUniformZOffset(ControlList* cl, float data);
@@ -135,6 +166,7 @@ void clInsertGEMRelocations(ControlList* cl,
 void clInsertShaderRecord(ControlList* cls,
 						  ControlList* relocCl,
 						  ControlList* handlesCl,
+						  ControlListHandleHash* handlesHash,
 						  uint32_t fragmentShaderIsSingleThreaded, //0/1
 						  uint32_t pointSizeIncludedInShadedVertexData, //0/1
 						  uint32_t enableClipping, //0/1
@@ -155,12 +187,13 @@ void clInsertShaderRecord(ControlList* cls,
 void clInsertAttributeRecord(ControlList* cls,
 							 ControlList* relocCl,
 							 ControlList* handlesCl,
+							 ControlListHandleHash* handlesHash,
 						  ControlListAddress address,
 						  uint32_t sizeBytes,
 						  uint32_t stride,
 						  uint32_t vertexVPMOffset,
 						  uint32_t coordinateVPMOffset);
-uint32_t clGetHandleIndex(ControlList* handlesCl, uint32_t handle);
+uint32_t clGetHandleIndex(ControlList* handlesCl, ControlListHandleHash* handlesHash, uint32_t handle);
 
 #if defined (__cplusplus)
 }
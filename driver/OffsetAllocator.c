@@ -0,0 +1,201 @@
+#include "common.h"
+
+//smallest order that holds numBlocks
+static uint32_t getOrder(uint32_t numBlocks)
+{
+	assert(numBlocks);
+	return numBlocks > 1 ? 32 - __builtin_clz(numBlocks - 1) : 0;
+}
+
+static void addFreeChunk(OffsetAllocator* oa, uint32_t block, uint32_t order)
+{
+	uint32_t next = oa->freeLists[order];
+	oa->links[block * 2] = next;
+	oa->links[block * 2 + 1] = OFFSET_ALLOCATOR_INVALID;
+	if(next != OFFSET_ALLOCATOR_INVALID)
+	{
+		oa->links[next * 2 + 1] = block;
+	}
+	oa->freeLists[order] = block;
+	oa->freeListMask |= 1u << order;
+	oa->freeOrder[block] = order + 1;
+	oa->numFreeBlocks += 1u << order;
+}
+
+static void removeFreeChunk(OffsetAllocator* oa, uint32_t block, uint32_t order)
+{
+	assert(oa->freeOrder[block] == order + 1);
+
+	uint32_t next = oa->links[block * 2];
+	uint32_t prev = oa->links[block * 2 + 1];
+	if(prev != OFFSET_ALLOCATOR_INVALID)
+	{
+		oa->links[prev * 2] = next;
+	}
+	else
+	{
+		oa->freeLists[order] = next;
+	}
+
+	if(next != OFFSET_ALLOCATOR_INVALID)
+	{
+		oa->links[next * 2 + 1] = prev;
+	}
+
+	if(oa->freeLists[order] == OFFSET_ALLOCATOR_INVALID)
+	{
+		oa->freeListMask &= ~(1u << order);
+	}
+	oa->freeOrder[block] = 0;
+	oa->numFreeBlocks -= 1u << order;
+}
+
+//returns the buddy of the chunk if it is free as a whole, -1 otherwise
+static int32_t getFreeBuddy(OffsetAllocator* oa, uint32_t block, uint32_t order)
+{
+	uint32_t buddy = block ^ (1u << order);
+	if(buddy + (1u << order) > oa->numBlocks || oa->freeOrder[buddy] != order + 1)
+	{
+		return -1;
+	}
+	return buddy;
+}
+
+OffsetAllocator createOffsetAllocator(uint32_t numBlocks, const VkAllocationCallbacks* pAllocator)
+{
+	assert(numBlocks);
+
+	OffsetAllocator oa =
+	{
+		.freeListMask = 0,
+		.numBlocks = numBlocks,
+		.numFreeBlocks = 0
+	};
+
+	oa.freeOrder = ALLOCATE(numBlocks, 1, VK_SYSTEM_ALLOCATION_SCOPE_OBJECT);
+	oa.links = ALLOCATE(numBlocks * 2 * sizeof(uint32_t), 1, VK_SYSTEM_ALLOCATION_SCOPE_OBJECT);
+
+	for(uint32_t c = 0; c < OFFSET_ALLOCATOR_MAX_ORDER; ++c)
+	{
+		oa.freeLists[c] = OFFSET_ALLOCATOR_INVALID;
+	}
+
+	if(!oa.freeOrder || !oa.links)
+	{
+		//no free chunks, every allocation fails
+		return oa;
+	}
+
+	memset(oa.freeOrder, 0, numBlocks);
+
+	//cover the range with the largest aligned chunks that fit
+	uint32_t block = 0;
+	while(block < oa.numBlocks)
+	{
+		uint32_t order = block ? __builtin_ctz(block) : OFFSET_ALLOCATOR_MAX_ORDER - 1;
+		while(block + (1u << order) > oa.numBlocks)
+		{
+			order--;
+		}
+
+		addFreeChunk(&oa, block, order);
+		block += 1u << order;
+	}
+
+	return oa;
+}
+
+void destroyOffsetAllocator(OffsetAllocator* oa, const VkAllocationCallbacks* pAllocator)
+{
+	FREE(oa->freeOrder);
+	FREE(oa->links);
+	oa->freeOrder = 0;
+	oa->links = 0;
+	oa->freeListMask = 0;
+	oa->numBlocks = 0;
+	oa->numFreeBlocks = 0;
+}
+
+//returns the first of numBlocks consecutive blocks, or OFFSET_ALLOCATOR_INVALID
+uint32_t offsetAllocate(OffsetAllocator* oa, uint32_t numBlocks)
+{
+	assert(numBlocks);
+
+	uint32_t order = getOrder(numBlocks);
+	if(order >= OFFSET_ALLOCATOR_MAX_ORDER)
+	{
+		return OFFSET_ALLOCATOR_INVALID;
+	}
+
+	//smallest free chunk that is large enough
+	uint32_t candidates = oa->freeListMask & ~((1u << order) - 1);
+	if(!candidates)
+	{
+		return OFFSET_ALLOCATOR_INVALID;
+	}
+
+	uint32_t freeOrder = __builtin_ctz(candidates);
+	uint32_t block = oa->freeLists[freeOrder];
+	removeFreeChunk(oa, block, freeOrder);
+
+	//split, the upper halves go back to the free lists
+	while(freeOrder > order)
+	{
+		freeOrder--;
+		addFreeChunk(oa, block + (1u << freeOrder), freeOrder);
+	}
+
+	return block;
+}
+
+void offsetFree(OffsetAllocator* oa, uint32_t block, uint32_t numBlocks)
+{
+	assert(block < oa->numBlocks);
+
+	uint32_t order = getOrder(numBlocks);
+
+	assert(!(block & ((1u << order) - 1))); //chunks are aligned to their size
+	assert(!oa->freeOrder[block]); //double free
+
+	//merge with free buddies as long as possible
+	for(int32_t buddy = getFreeBuddy(oa, block, order); buddy > -1; buddy = getFreeBuddy(oa, block, order))
+	{
+		removeFreeChunk(oa, buddy, order);
+		block = block < (uint32_t)buddy ? block : (uint32_t)buddy;
+		order++;
+	}
+
+	addFreeChunk(oa, block, order);
+}
+
+//grows the chunk of numBlocks at block in place so it holds newNumBlocks, keeping its start
+//returns 0 if that would need buddies that are not free
+uint32_t offsetGrow(OffsetAllocator* oa, uint32_t block, uint32_t numBlocks, uint32_t newNumBlocks)
+{
+	assert(block < oa->numBlocks);
+	assert(newNumBlocks >= numBlocks);
+
+	uint32_t order = getOrder(numBlocks);
+	uint32_t newOrder = getOrder(newNumBlocks);
+
+	//only the lower half of a chunk can take over its buddy
+	if(newOrder >= OFFSET_ALLOCATOR_MAX_ORDER || (block & ((1u << newOrder) - 1)))
+	{
+		return 0;
+	}
+
+	for(uint32_t o = order; o < newOrder; ++o)
+	{
+		if(getFreeBuddy(oa, block, o) < 0)
+		{
+			return 0;
+		}
+	}
+
+	for(uint32_t o = order; o < newOrder; ++o)
+	{
+		removeFreeChunk(oa, block + (1u << o), o);
+	}
+
+	return 1;
+}
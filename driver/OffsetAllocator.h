@@ -0,0 +1,38 @@
+#pragma once
+
+#if defined (__cplusplus)
+extern "C" {
+#endif
+
+#include "CustomAssert.h"
+
+#include <stdint.h>
+#include <vulkan/vulkan.h>
+
+//orders are log2 of the number of blocks in a chunk
+#define OFFSET_ALLOCATOR_MAX_ORDER 32
+//returned when there is no free chunk large enough
+#define OFFSET_ALLOCATOR_INVALID 0xffffffff
+
+//buddy allocator handing out block offsets into memory it never touches, eg. a BO
+//all bookkeeping is kept on the side, allocated through pAllocator
+//this is the buddy core of the other block allocators, see ConsecutivePoolAllocator
+typedef struct OffsetAllocator
+{
+	uint8_t* freeOrder; //per block: order + 1 if a free chunk of that order starts at the block, 0 otherwise
+	uint32_t* links; //per block: next and prev free chunk of the same order, valid where freeOrder is set
+	uint32_t freeLists[OFFSET_ALLOCATOR_MAX_ORDER]; //first block of each order's free list
+	uint32_t freeListMask; //bit n is set if freeLists[n] is not empty
+	uint32_t numBlocks;
+	uint32_t numFreeBlocks;
+} OffsetAllocator;
+
+OffsetAllocator createOffsetAllocator(uint32_t numBlocks, const VkAllocationCallbacks* pAllocator);
+void destroyOffsetAllocator(OffsetAllocator* oa, const VkAllocationCallbacks* pAllocator);
+uint32_t offsetAllocate(OffsetAllocator* oa, uint32_t numBlocks);
+void offsetFree(OffsetAllocator* oa, uint32_t block, uint32_t numBlocks);
+uint32_t offsetGrow(OffsetAllocator* oa, uint32_t block, uint32_t numBlocks, uint32_t newNumBlocks);
+
+#if defined (__cplusplus)
+}
+#endif
@@ -0,0 +1,79 @@
+#include "SPSCQueue.h"
+
+#include "CustomAssert.h"
+
+#include <stdint.h>
+#include <string.h>
+
+SPSCQueue createSPSCQueue(char* b, unsigned es, unsigned s)
+{
+	assert(b); //only allocated memory
+	assert(es > 0);
+	assert(s%es==0); //we want a size that is the exact multiple of element size
+	assert(s >= es); //at least 1 element
+	assert(!((s / es) & (s / es - 1))); //power of two element count so free running indices wrap correctly
+
+	SPSCQueue q =
+	{
+		.buf = b,
+		.elementSize = es,
+		.numElements = s / es,
+		.head = 0,
+		.tail = 0
+	};
+
+	return q;
+}
+
+void destroySPSCQueue(SPSCQueue* q)
+{
+	//actual memory freeing is done by caller
+	q->buf = 0;
+	q->elementSize = 0;
+	q->numElements = 0;
+}
+
+//returns 0 if the queue is full
+uint32_t spscQueuePush(SPSCQueue* q, const void* element)
+{
+	assert(q->buf);
+	assert(element);
+
+	unsigned tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+	unsigned head = atomic_load_explicit(&q->head, memory_order_acquire);
+
+	//indices are free running, unsigned wraparound keeps the difference correct
+	if(tail - head == q->numElements)
+	{
+		return 0;
+	}
+
+	memcpy(q->buf + (tail % q->numElements) * q->elementSize, element, q->elementSize);
+
+	//publish the element to the consumer
+	atomic_store_explicit(&q->tail, tail + 1, memory_order_release);
+
+	return 1;
+}
+
+//returns 0 if the queue is empty
+uint32_t spscQueuePop(SPSCQueue* q, void* element)
+{
+	assert(q->buf);
+	assert(element);
+
+	unsigned head = atomic_load_explicit(&q->head, memory_order_relaxed);
+	unsigned tail = atomic_load_explicit(&q->tail, memory_order_acquire);
+
+	if(head == tail)
+	{
+		return 0;
+	}
+
+	memcpy(element, q->buf + (head % q->numElements) * q->elementSize, q->elementSize);
+
+	//hand the slot back to the producer
+	atomic_store_explicit(&q->head, head + 1, memory_order_release);
+
+	return 1;
+}
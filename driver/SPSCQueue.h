@@ -0,0 +1,30 @@
+#pragma once
+
+#if defined (__cplusplus)
+extern "C" {
+#endif
+
+#include "CustomAssert.h"
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+//lock-free ring of fixed size elements
+//safe to use with exactly one producer and one consumer thread
+typedef struct SPSCQueue
+{
+	char* buf; //preallocated buffer
+	unsigned elementSize;
+	unsigned numElements;
+	atomic_uint head; //next element to pop, only written by the consumer
+	atomic_uint tail; //next element to push, only written by the producer
+} SPSCQueue;
+
+SPSCQueue createSPSCQueue(char* b, unsigned es, unsigned s);
+void destroySPSCQueue(SPSCQueue* q);
+uint32_t spscQueuePush(SPSCQueue* q, const void* element);
+uint32_t spscQueuePop(SPSCQueue* q, void* element);
+
+#if defined (__cplusplus)
+}
+#endif
@@ -0,0 +1,315 @@
+#include "common.h"
+
+#include "Tracer.h"
+
+#include <stdatomic.h>
+
+typedef enum TraceRecordType
+{
+	TRACE_RECORD_SUBMIT = 0,
+	TRACE_RECORD_SEQNO_WAIT,
+	TRACE_RECORD_BO_ALLOC,
+	TRACE_RECORD_BO_FREE,
+	TRACE_RECORD_BO_WAIT,
+	TRACE_RECORD_COMMAND_BUFFER,
+	TRACE_RECORD_RENDER_PASS
+} TraceRecordType;
+
+typedef struct TraceRecord
+{
+	atomic_uint stamp; //index of the write that completed this record + 1, 0 while being written
+	uint32_t type;
+	uint64_t seqno;
+	uint32_t bo;
+	uint32_t size;
+	struct drm_vc4_submit_cl submit;
+	uint32_t numHandles;
+	uint32_t handles[TRACE_MAX_HANDLES];
+	uint32_t clSize; //size of the original CL, copy is truncated to TRACE_MAX_CL_SIZE
+	uint32_t bytesLoaded, bytesStored, bytesSaved; //tile buffer traffic of a render pass
+} TraceRecord;
+
+uint32_t traceMask = 0;
+
+static pthread_once_t traceOnce = PTHREAD_ONCE_INIT;
+static TraceRecord* traceRing = 0;
+static uint8_t* traceClStorage = 0; //TRACE_MAX_CL_SIZE bytes for each record
+static atomic_uint traceHead = 0;
+
+static void traceParseEnv()
+{
+	const char* env = getenv("RPI_VK_TRACE");
+	if(!env)
+	{
+		return;
+	}
+
+	uint32_t mask = 0;
+	const char* c = env;
+	while(*c)
+	{
+		const char* end = strchr(c, ',');
+		uint32_t len = end ? end - c : strlen(c);
+
+		if(len == 6 && !strncmp(c, "submit", len)) mask |= TRACE_SUBMIT;
+		else if(len == 2 && !strncmp(c, "cl", len)) mask |= TRACE_SUBMIT | TRACE_CL;
+		else if(len == 2 && !strncmp(c, "bo", len)) mask |= TRACE_BO;
+		else if(len == 3 && !strncmp(c, "all", len)) mask |= TRACE_ALL;
+		else if(len) fprintf(stderr, "RPI_VK_TRACE: unknown category %.*s\n", len, c);
+
+		c += len;
+		if(*c == ',') c++;
+	}
+
+	if(!mask)
+	{
+		return;
+	}
+
+	traceRing = calloc(TRACE_RING_SIZE, sizeof(TraceRecord));
+	if(!traceRing)
+	{
+		return;
+	}
+
+	if(mask & TRACE_CL)
+	{
+		traceClStorage = malloc(TRACE_RING_SIZE * TRACE_MAX_CL_SIZE);
+		if(!traceClStorage)
+		{
+			mask &= ~TRACE_CL;
+		}
+	}
+
+	traceMask = mask;
+	atexit(traceDump);
+}
+
+void traceInit()
+{
+	pthread_once(&traceOnce, traceParseEnv);
+}
+
+//claim the next slot in the ring, the record is invalid until traceCommit is called
+static TraceRecord* traceBegin(uint32_t* index)
+{
+	*index = atomic_fetch_add_explicit(&traceHead, 1, memory_order_relaxed);
+	TraceRecord* r = &traceRing[*index % TRACE_RING_SIZE];
+	atomic_store_explicit(&r->stamp, 0, memory_order_release);
+	return r;
+}
+
+static void traceCommit(TraceRecord* r, uint32_t index)
+{
+	atomic_store_explicit(&r->stamp, index + 1, memory_order_release);
+}
+
+void traceSubmit(const struct drm_vc4_submit_cl* submit)
+{
+	assert(submit);
+
+	if(!traceEnabled(TRACE_SUBMIT))
+	{
+		return;
+	}
+
+	uint32_t index;
+	TraceRecord* r = traceBegin(&index);
+	r->type = TRACE_RECORD_SUBMIT;
+	r->seqno = submit->seqno;
+	r->submit = *submit;
+	r->numHandles = 0;
+	r->clSize = submit->bin_cl_size;
+
+	if(traceEnabled(TRACE_BO))
+	{
+		r->numHandles = min(submit->bo_handle_count, TRACE_MAX_HANDLES);
+		memcpy(r->handles, (void*)(uintptr_t)submit->bo_handles, r->numHandles * 4);
+	}
+
+	if(traceEnabled(TRACE_CL))
+	{
+		memcpy(traceClStorage + (index % TRACE_RING_SIZE) * TRACE_MAX_CL_SIZE,
+			   (void*)(uintptr_t)submit->bin_cl,
+			   min(submit->bin_cl_size, TRACE_MAX_CL_SIZE));
+	}
+
+	traceCommit(r, index);
+}
+
+static void traceEvent(uint32_t type, uint32_t bo, uint32_t size, uint64_t seqno)
+{
+	uint32_t index;
+	TraceRecord* r = traceBegin(&index);
+	r->type = type;
+	r->bo = bo;
+	r->size = size;
+	r->seqno = seqno;
+	traceCommit(r, index);
+}
+
+void traceSeqnoWait(uint64_t seqno)
+{
+	if(traceEnabled(TRACE_SUBMIT))
+	{
+		traceEvent(TRACE_RECORD_SEQNO_WAIT, 0, 0, seqno);
+	}
+}
+
+//bo is reused for the number of state bytes vkCmdDraw did not have to emit
+void traceCommandBuffer(uint32_t binClSize, uint32_t stateBytesSaved)
+{
+	if(traceEnabled(TRACE_SUBMIT))
+	{
+		traceEvent(TRACE_RECORD_COMMAND_BUFFER, stateBytesSaved, binClSize, 0);
+	}
+}
+
+//size is reused for the number of tiles rendered
+void traceRenderPass(uint32_t numTiles, uint32_t bytesLoaded, uint32_t bytesStored, uint32_t bytesSaved)
+{
+	if(!traceEnabled(TRACE_SUBMIT))
+	{
+		return;
+	}
+
+	uint32_t index;
+	TraceRecord* r = traceBegin(&index);
+	r->type = TRACE_RECORD_RENDER_PASS;
+	r->size = numTiles;
+	r->bytesLoaded = bytesLoaded;
+	r->bytesStored = bytesStored;
+	r->bytesSaved = bytesSaved;
+	traceCommit(r, index);
+}
+
+void traceBoAlloc(uint32_t bo, uint32_t size)
+{
+	if(traceEnabled(TRACE_BO))
+	{
+		traceEvent(TRACE_RECORD_BO_ALLOC, bo, size, 0);
+	}
+}
+
+void traceBoFree(uint32_t bo)
+{
+	if(traceEnabled(TRACE_BO))
+	{
+		traceEvent(TRACE_RECORD_BO_FREE, bo, 0, 0);
+	}
+}
+
+void traceBoWait(uint32_t bo)
+{
+	if(traceEnabled(TRACE_BO))
+	{
+		traceEvent(TRACE_RECORD_BO_WAIT, bo, 0, 0);
+	}
+}
+
+static void tracePrintSurface(const char* name, const struct drm_vc4_submit_rcl_surface* s)
+{
+	printf("%s surf: hindex, offset, bits, flags %u %u %u %u\n", name, s->hindex, s->offset, s->bits, s->flags);
+}
+
+static void tracePrintRecord(const TraceRecord* r, const uint8_t* cl)
+{
+	switch(r->type)
+	{
+	case TRACE_RECORD_SUBMIT:
+	{
+		const struct drm_vc4_submit_cl* s = &r->submit;
+		printf("submit seqno %llu\n", (unsigned long long)r->seqno);
+		if(cl)
+		{
+			printf("BCL (%u bytes):\n", r->clSize);
+			clDump((void*)cl, min(r->clSize, TRACE_MAX_CL_SIZE));
+		}
+		if(r->numHandles)
+		{
+			printf("BO handles: ");
+			for(uint32_t d = 0; d < r->numHandles; ++d)
+			{
+				printf("%u ", r->handles[d]);
+			}
+			printf("\n");
+		}
+		printf("width height: %u, %u\n", s->width, s->height);
+		printf("tile min/max: %u,%u %u,%u\n", s->min_x_tile, s->min_y_tile, s->max_x_tile, s->max_y_tile);
+		tracePrintSurface("color read", &s->color_read);
+		tracePrintSurface("color write", &s->color_write);
+		tracePrintSurface("zs read", &s->zs_read);
+		tracePrintSurface("zs write", &s->zs_write);
+		tracePrintSurface("msaa color write", &s->msaa_color_write);
+		tracePrintSurface("msaa zs write", &s->msaa_zs_write);
+		printf("clear color packed rgba %u %u\n", s->clear_color[0], s->clear_color[1]);
+		printf("clear z %u\n", s->clear_z);
+		printf("clear s %u\n", s->clear_s);
+		printf("flags %u\n", s->flags);
+		break;
+	}
+	case TRACE_RECORD_SEQNO_WAIT:
+		printf("wait for seqno %llu\n", (unsigned long long)r->seqno);
+		break;
+	case TRACE_RECORD_BO_ALLOC:
+		printf("BO alloc %u, size %u\n", r->bo, r->size);
+		break;
+	case TRACE_RECORD_BO_FREE:
+		printf("BO free %u\n", r->bo);
+		break;
+	case TRACE_RECORD_BO_WAIT:
+		printf("wait for BO %u\n", r->bo);
+		break;
+	case TRACE_RECORD_COMMAND_BUFFER:
+		printf("command buffer recorded, BCL %u bytes, %u bytes of redundant state skipped\n", r->size, r->bo);
+		break;
+	case TRACE_RECORD_RENDER_PASS:
+		printf("render pass recorded, %u tiles, estimated %u bytes loaded and %u bytes stored, %u bytes skipped by load/store ops\n",
+			   r->size, r->bytesLoaded, r->bytesStored, r->bytesSaved);
+		break;
+	}
+}
+
+//decode and print every record still in the ring, oldest first
+//records being overwritten while we read them are skipped
+void traceDump()
+{
+	if(!traceMask)
+	{
+		return;
+	}
+
+	static uint8_t cl[TRACE_MAX_CL_SIZE];
+
+	uint32_t head = atomic_load_explicit(&traceHead, memory_order_acquire);
+	uint32_t first = head > TRACE_RING_SIZE ? head - TRACE_RING_SIZE : 0;
+
+	for(uint32_t c = first; c < head; ++c)
+	{
+		TraceRecord* slot = &traceRing[c % TRACE_RING_SIZE];
+		uint32_t stamp = atomic_load_explicit(&slot->stamp, memory_order_acquire);
+		if(stamp != c + 1)
+		{
+			continue;
+		}
+
+		TraceRecord r;
+		memcpy(&r, slot, sizeof(TraceRecord));
+
+		int hasCl = r.type == TRACE_RECORD_SUBMIT && traceEnabled(TRACE_CL);
+		if(hasCl)
+		{
+			memcpy(cl, traceClStorage + (c % TRACE_RING_SIZE) * TRACE_MAX_CL_SIZE, TRACE_MAX_CL_SIZE);
+		}
+
+		atomic_thread_fence(memory_order_acquire);
+		if(atomic_load_explicit(&slot->stamp, memory_order_relaxed) != stamp)
+		{
+			continue;
+		}
+
+		tracePrintRecord(&r, hasCl ? cl : 0);
+	}
+
+	fflush(stdout);
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#if defined (__cplusplus)
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <drm/vc4_drm.h>
+
+//opt-in tracing, enabled through the environment, eg.
+//RPI_VK_TRACE=submit,cl,bo
+//records are stored in a lock-free ring buffer and only decoded
+//when traceDump() is called or when the process exits
+typedef enum TraceCategory
+{
+	TRACE_SUBMIT = 1 << 0, //submit metadata, seqno waits, recorded command buffer sizes and render pass bandwidth
+	TRACE_CL = 1 << 1, //copy of the binning control list of each submit
+	TRACE_BO = 1 << 2, //BO handles of each submit, BO allocations, frees and waits
+	TRACE_ALL = TRACE_SUBMIT | TRACE_CL | TRACE_BO
+} TraceCategory;
+
+//number of records kept, older ones get overwritten
+#define TRACE_RING_SIZE 256
+//control lists larger than this are truncated
+#define TRACE_MAX_CL_SIZE 4096
+//handle lists larger than this are truncated
+#define TRACE_MAX_HANDLES 64
+
+extern uint32_t traceMask;
+
+#define traceEnabled(category) (traceMask & (category))
+
+void traceInit();
+void traceSubmit(const struct drm_vc4_submit_cl* submit);
+void traceSeqnoWait(uint64_t seqno);
+void traceCommandBuffer(uint32_t binClSize, uint32_t stateBytesSaved);
+void traceRenderPass(uint32_t numTiles, uint32_t bytesLoaded, uint32_t bytesStored, uint32_t bytesSaved);
+void traceBoAlloc(uint32_t bo, uint32_t size);
+void traceBoFree(uint32_t bo);
+void traceBoWait(uint32_t bo);
+void traceDump();
+
+#if defined (__cplusplus)
+}
+#endif
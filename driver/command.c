@@ -1,8 +1,9 @@
+#define _GNU_SOURCE
 #include "common.h"
 
 #include "kernel/vc4_packet.h"
-#include "../brcm/cle/v3d_decoder.h"
-#include "../brcm/clif/clif_dump.h"
+
+#include <time.h>
 
 /*
  * https://www.khronos.org/registry/vulkan/specs/1.1-extensions/html/vkspec.html#commandbuffers-pools
@@ -40,44 +41,186 @@ VKAPI_ATTR VkResult VKAPI_CALL vkCreateCommandPool(
 
 	cp->queueFamilyIndex = pCreateInfo->queueFamilyIndex;
 
-	//TODO CTS fails as we can't allocate enough memory for some reason
-	//tweak system allocation as root using:
-	//make sure kernel denies memory allocation that it won't be able to serve
-	//sysctl -w vm.overcommit_memory="2"
-	//specify after how much memory used the kernel will start denying requests
-	//sysctl -w vm.overcommit_ratio="80"
-	//
+	//slabs are only allocated once command buffers need them
+	cp->commandBufferSlabs = 0;
+	cp->controlListSlabs = 0;
+	cp->nextCommandBufferSlabSize = COMMAND_POOL_MIN_COMMAND_BUFFERS;
+	cp->nextControlListSlabSize = COMMAND_POOL_MIN_CL_SIZE;
+
+	cp->hasAllocator = pAllocator != 0;
+	if(pAllocator)
+	{
+		cp->allocator = *pAllocator;
+	}
+
+	*pCommandPool = (VkCommandPool)cp;
+
+	return VK_SUCCESS;
+}
+
+static void* commandPoolAllocateHost(_commandPool* cp, uint32_t size)
+{
+	const VkAllocationCallbacks* pAllocator = cp->hasAllocator ? &cp->allocator : 0;
+	return ALLOCATE(size, 1, VK_SYSTEM_ALLOCATION_SCOPE_OBJECT);
+}
+
+static void commandPoolFreeHost(_commandPool* cp, void* p)
+{
+	const VkAllocationCallbacks* pAllocator = cp->hasAllocator ? &cp->allocator : 0;
+	FREE(p);
+}
+
+static _commandBuffer* commandPoolAllocateCommandBuffer(_commandPool* cp)
+{
+	for(_commandBufferSlab* slab = cp->commandBufferSlabs; slab; slab = slab->next)
+	{
+		_commandBuffer* cb = poolAllocate(&slab->pa);
+		if(cb)
+		{
+			slab->numAllocations++;
+			return cb;
+		}
+	}
+
+	//every slab is full, chain a new one
+	uint32_t size = cp->nextCommandBufferSlabSize * sizeof(_commandBuffer);
+	_commandBufferSlab* slab = commandPoolAllocateHost(cp, sizeof(_commandBufferSlab) + size);
+	if(!slab)
+	{
+		return 0;
+	}
 
+	//free command buffers have no pool, vkResetCommandPool relies on this
+	memset(slab + 1, 0, size);
+	slab->pa = createPoolAllocator((char*)(slab + 1), sizeof(_commandBuffer), size);
+	slab->numAllocations = 1;
+	slab->next = cp->commandBufferSlabs;
+	cp->commandBufferSlabs = slab;
+	cp->nextCommandBufferSlabSize = min(cp->nextCommandBufferSlabSize * 2, COMMAND_POOL_MAX_COMMAND_BUFFERS);
 
+	return poolAllocate(&slab->pa);
+}
 
-	//initial number of command buffers to hold
-	int numCommandBufs = 128;
-	int consecutivePoolSize = ARM_PAGE_SIZE*128;
-	int consecutiveBlockSize = ARM_PAGE_SIZE>>2;
+static void commandPoolFreeCommandBuffer(_commandPool* cp, _commandBuffer* cb)
+{
+	for(_commandBufferSlab* slab = cp->commandBufferSlabs; slab; slab = slab->next)
+	{
+		if((char*)cb >= slab->pa.buf && (char*)cb < slab->pa.buf + slab->pa.size)
+		{
+			cb->cp = 0;
+			poolFree(&slab->pa, cb);
+			slab->numAllocations--;
+			return;
+		}
+	}
 
-	static int counter = 0;
+	assert(0); //not allocated from this pool
+}
 
-	//if(pCreateInfo->flags & VK_COMMAND_POOL_CREATE_TRANSIENT_BIT)
+static _controlListSlab* commandPoolFindControlListSlab(_commandPool* cp, void* p)
+{
+	for(_controlListSlab* slab = cp->controlListSlabs; slab; slab = slab->next)
 	{
-		//use pool allocator
-		void* pamem = ALLOCATE(numCommandBufs * sizeof(_commandBuffer), 1, VK_SYSTEM_ALLOCATION_SCOPE_OBJECT);
-		if(!pamem)
+		if((char*)p >= slab->cpa.buf && (char*)p < slab->cpa.buf + slab->cpa.size)
 		{
-			return VK_ERROR_OUT_OF_HOST_MEMORY;
+			return slab;
 		}
-		cp->pa = createPoolAllocator(pamem, sizeof(_commandBuffer), numCommandBufs * sizeof(_commandBuffer));
+	}
+
+	return 0;
+}
+
+//allocate numBlocks consecutive blocks of COMMAND_POOL_BLOCK_SIZE for a control list
+void* commandPoolAllocate(_commandPool* cp, uint32_t numBlocks)
+{
+	assert(cp);
 
-		void* cpamem = ALLOCATE(consecutivePoolSize, 1, VK_SYSTEM_ALLOCATION_SCOPE_OBJECT);
-		if(!cpamem)
+	for(_controlListSlab* slab = cp->controlListSlabs; slab; slab = slab->next)
+	{
+		void* p = consecutivePoolAllocate(&slab->cpa, numBlocks);
+		if(p)
 		{
-			return VK_ERROR_OUT_OF_HOST_MEMORY;
+			slab->numAllocations++;
+			return p;
 		}
-		cp->cpa = createConsecutivePoolAllocator(cpamem, consecutiveBlockSize, consecutivePoolSize);
 	}
 
-	*pCommandPool = (VkCommandPool)cp;
+	//every slab is full, chain a new one that is large enough
+	//the allocator rounds to a power of two number of blocks
+	uint32_t size = cp->nextControlListSlabSize;
+	while(size < numBlocks * COMMAND_POOL_BLOCK_SIZE)
+	{
+		size *= 2;
+	}
 
-	return VK_SUCCESS;
+	_controlListSlab* slab = commandPoolAllocateHost(cp, sizeof(_controlListSlab) + size);
+	if(!slab)
+	{
+		return 0;
+	}
+
+	slab->cpa = createConsecutivePoolAllocator((char*)(slab + 1), COMMAND_POOL_BLOCK_SIZE, size, cp->hasAllocator ? &cp->allocator : 0);
+	slab->numAllocations = 1;
+	slab->next = cp->controlListSlabs;
+	cp->controlListSlabs = slab;
+	cp->nextControlListSlabSize = min(cp->nextControlListSlabSize * 2, COMMAND_POOL_MAX_CL_SIZE);
+
+	return consecutivePoolAllocate(&slab->cpa, numBlocks);
+}
+
+void commandPoolFree(_commandPool* cp, void* p, uint32_t numBlocks)
+{
+	assert(cp);
+	assert(p);
+
+	_controlListSlab* slab = commandPoolFindControlListSlab(cp, p);
+	assert(slab); //not allocated from this pool
+
+	consecutivePoolFree(&slab->cpa, p, numBlocks);
+	slab->numAllocations--;
+}
+
+//grow by one block, if the current slab can't do that the contents are moved to another one
+void* commandPoolReAllocate(_commandPool* cp, void* currentMem, uint32_t currNumBlocks)
+{
+	assert(cp);
+	assert(currentMem);
+
+	_controlListSlab* slab = commandPoolFindControlListSlab(cp, currentMem);
+	assert(slab); //not allocated from this pool
+
+	void* ret = consecutivePoolReAllocate(&slab->cpa, currentMem, currNumBlocks);
+	if(ret)
+	{
+		return ret;
+	}
+
+	ret = commandPoolAllocate(cp, currNumBlocks + 1);
+	if(!ret)
+	{
+		return 0;
+	}
+
+	memcpy(ret, currentMem, currNumBlocks * COMMAND_POOL_BLOCK_SIZE);
+	commandPoolFree(cp, currentMem, currNumBlocks);
+	return ret;
+}
+
+static void commandPoolFreeControlLists(_commandPool* cp, _commandBuffer* cb)
+{
+	ControlList* cls[] = { &cb->binCl, &cb->handlesCl, &cb->shaderRecCl, &cb->uniformsCl, &cb->jobsCl };
+	for(int c = 0; c < sizeof(cls) / sizeof(ControlList*); ++c)
+	{
+		if(cls[c]->firstChunk)
+		{
+			clReset(cb, cls[c]);
+			commandPoolFree(cp, cls[c]->firstChunk, cls[c]->firstChunk->numBlocks);
+		}
+		else if(cls[c]->buffer)
+		{
+			commandPoolFree(cp, cls[c]->buffer, cls[c]->numBlocks);
+		}
+	}
 }
 
 /*
@@ -98,11 +241,14 @@ VKAPI_ATTR VkResult VKAPI_CALL vkAllocateCommandBuffers(
 
 	_commandPool* cp = (_commandPool*)pAllocateInfo->commandPool;
 
+	//on failure every element must be null, so we know what to clean up
+	memset(pCommandBuffers, 0, sizeof(VkCommandBuffer) * pAllocateInfo->commandBufferCount);
+
 	//if(cp->usePoolAllocator)
 	{
 		for(int c = 0; c < pAllocateInfo->commandBufferCount; ++c)
 		{
-			pCommandBuffers[c] = poolAllocate(&cp->pa);
+			pCommandBuffers[c] = commandPoolAllocateCommandBuffer(cp);
 
 			if(!pCommandBuffers[c])
 			{
@@ -113,34 +259,26 @@ VKAPI_ATTR VkResult VKAPI_CALL vkAllocateCommandBuffers(
 			pCommandBuffers[c]->shaderRecCount = 0;
 			pCommandBuffers[c]->usageFlags = 0;
 			pCommandBuffers[c]->state = CMDBUF_STATE_INITIAL;
+			atomic_init(&pCommandBuffers[c]->numPendingSubmits, 0);
+			pCommandBuffers[c]->recordResult = VK_SUCCESS;
 			pCommandBuffers[c]->cp = cp;
-			clInit(&pCommandBuffers[c]->binCl, consecutivePoolAllocate(&cp->cpa, 1));
-			clInit(&pCommandBuffers[c]->handlesCl, consecutivePoolAllocate(&cp->cpa, 1));
-			clInit(&pCommandBuffers[c]->shaderRecCl, consecutivePoolAllocate(&cp->cpa, 1));
-			clInit(&pCommandBuffers[c]->uniformsCl, consecutivePoolAllocate(&cp->cpa, 1));
+			clInitChunked(&pCommandBuffers[c]->binCl, commandPoolAllocate(cp, 1), 1);
+			clInit(&pCommandBuffers[c]->handlesCl, commandPoolAllocate(cp, 1));
+			clInit(&pCommandBuffers[c]->shaderRecCl, commandPoolAllocate(cp, 1));
+			clInit(&pCommandBuffers[c]->uniformsCl, commandPoolAllocate(cp, 1));
+			clInit(&pCommandBuffers[c]->jobsCl, commandPoolAllocate(cp, 1));
+			pCommandBuffers[c]->numJobs = 0;
+			clInitHandleHash(&pCommandBuffers[c]->handlesHash);
 
 			pCommandBuffers[c]->renderpass = 0;
 			pCommandBuffers[c]->fbo = 0;
 			pCommandBuffers[c]->currentSubpass = 0;
 			pCommandBuffers[c]->graphicsPipeline = 0;
 			pCommandBuffers[c]->computePipeline = 0;
-			pCommandBuffers[c]->firstDraw = 1;
-			pCommandBuffers[c]->vertexBufferDirty = 1;
-			pCommandBuffers[c]->indexBufferDirty = 1;
-			pCommandBuffers[c]->viewportDirty = 1;
-			pCommandBuffers[c]->lineWidthDirty = 1;
-			pCommandBuffers[c]->depthBiasDirty = 1;
-			pCommandBuffers[c]->graphicsPipelineDirty = 1;
-			pCommandBuffers[c]->computePipelineDirty = 1;
-			pCommandBuffers[c]->subpassDirty = 1;
-			pCommandBuffers[c]->blendConstantsDirty = 1;
-			pCommandBuffers[c]->scissorDirty = 1;
-			pCommandBuffers[c]->depthBoundsDirty = 1;
-			pCommandBuffers[c]->stencilCompareMaskDirty = 1;
-			pCommandBuffers[c]->stencilWriteMaskDirty = 1;
-			pCommandBuffers[c]->stencilReferenceDirty = 1;
-			pCommandBuffers[c]->descriptorSetDirty = 1;
-			pCommandBuffers[c]->pushConstantDirty = 1;
+			pCommandBuffers[c]->dirty = CMDBUF_DIRTY_ALL;
+			pCommandBuffers[c]->shadow.validMask = 0;
+			pCommandBuffers[c]->stateBytesSaved = 0;
+			pCommandBuffers[c]->numPendingClears = 0;
 
 			if(!pCommandBuffers[c]->binCl.buffer)
 			{
@@ -165,6 +303,12 @@ VKAPI_ATTR VkResult VKAPI_CALL vkAllocateCommandBuffers(
 				res = VK_ERROR_OUT_OF_HOST_MEMORY;
 				break;
 			}
+
+			if(!pCommandBuffers[c]->jobsCl.buffer)
+			{
+				res = VK_ERROR_OUT_OF_HOST_MEMORY;
+				break;
+			}
 		}
 	}
 
@@ -172,13 +316,10 @@ VKAPI_ATTR VkResult VKAPI_CALL vkAllocateCommandBuffers(
 	{
 		//if(cp->usePoolAllocator)
 		{
-			for(int c = 0; c < pAllocateInfo->commandBufferCount; ++c)
+			for(int c = 0; c < pAllocateInfo->commandBufferCount && pCommandBuffers[c]; ++c)
 			{
-				consecutivePoolFree(&cp->cpa, &pCommandBuffers[c]->binCl, pCommandBuffers[c]->binCl.numBlocks);
-				consecutivePoolFree(&cp->cpa, &pCommandBuffers[c]->handlesCl, pCommandBuffers[c]->binCl.numBlocks);
-				consecutivePoolFree(&cp->cpa, &pCommandBuffers[c]->shaderRecCl, pCommandBuffers[c]->binCl.numBlocks);
-				consecutivePoolFree(&cp->cpa, &pCommandBuffers[c]->uniformsCl, pCommandBuffers[c]->binCl.numBlocks);
-				poolFree(&cp->pa, pCommandBuffers[c]);
+				commandPoolFreeControlLists(cp, pCommandBuffers[c]);
+				commandPoolFreeCommandBuffer(cp, pCommandBuffers[c]);
 				pCommandBuffers[c] = 0;
 			}
 		}
@@ -210,21 +351,27 @@ VKAPI_ATTR VkResult VKAPI_CALL vkBeginCommandBuffer(
 
 	//When a command buffer begins recording, all state in that command buffer is undefined
 
-	struct drm_vc4_submit_cl submitCl =
-	{
-		.color_read.hindex = ~0,
-		.zs_read.hindex = ~0,
-		.color_write.hindex = ~0,
-		.msaa_color_write.hindex = ~0,
-		.zs_write.hindex = ~0,
-		.msaa_zs_write.hindex = ~0,
-	};
+	assert(!commandBufferIsPending(commandBuffer));
 
 	commandBuffer->usageFlags = pBeginInfo->flags;
 	commandBuffer->shaderRecCount = 0;
 	commandBuffer->state = CMDBUF_STATE_RECORDING;
-	commandBuffer->submitCl = submitCl;
-
+	commandBuffer->recordResult = VK_SUCCESS;
+	commandBuffer->numJobs = 0;
+
+	//implicit reset, handle indices in the CLs refer to the handles CL so they all start over
+	clReset(commandBuffer, &commandBuffer->binCl);
+	clReset(commandBuffer, &commandBuffer->handlesCl);
+	clReset(commandBuffer, &commandBuffer->shaderRecCl);
+	clReset(commandBuffer, &commandBuffer->uniformsCl);
+	clReset(commandBuffer, &commandBuffer->jobsCl);
+	clInitHandleHash(&commandBuffer->handlesHash);
+
+	//nothing is emitted yet, so every state packet has to be written by the first draw
+	commandBuffer->dirty = CMDBUF_DIRTY_ALL;
+	commandBuffer->shadow.validMask = 0;
+	commandBuffer->stateBytesSaved = 0;
+	commandBuffer->numPendingClears = 0;
 
 	return VK_SUCCESS;
 }
@@ -240,21 +387,503 @@ VKAPI_ATTR VkResult VKAPI_CALL vkEndCommandBuffer(
 {
 	assert(commandBuffer);
 
-	//Increment the semaphore indicating that binning is done and
-	//unblocking the render thread.  Note that this doesn't act
-	//until the FLUSH completes.
-	//The FLUSH caps all of our bin lists with a
-	//VC4_PACKET_RETURN.
-	clFit(commandBuffer, &commandBuffer->binCl, V3D21_INCREMENT_SEMAPHORE_length);
-	clInsertIncrementSemaphore(&commandBuffer->binCl);
-	clFit(commandBuffer, &commandBuffer->binCl, V3D21_FLUSH_length);
-	clInsertFlush(&commandBuffer->binCl);
+	//binning jobs are closed by vkCmdEndRenderPass
+	//clears that no render pass picked up still have to happen
+	commandBufferFlushClears(commandBuffer);
+
+	if(commandBuffer->recordResult != VK_SUCCESS)
+	{
+		commandBuffer->state = CMDBUF_STATE_INVALID;
+		return commandBuffer->recordResult;
+	}
+
+	//the kernel takes the binning CL as one contiguous buffer and doesn't accept branches in it
+	if(!clFlatten(commandBuffer, &commandBuffer->binCl))
+	{
+		return VK_ERROR_OUT_OF_HOST_MEMORY;
+	}
+
+	//the CLs don't move until the command buffer is recorded again, so the jobs can be turned into
+	//ready to use ioctl arguments once here instead of on every submit
+	struct drm_vc4_submit_cl* jobs = (struct drm_vc4_submit_cl*)commandBuffer->jobsCl.buffer;
+	for(uint32_t c = 0; c < commandBuffer->numJobs; ++c)
+	{
+		jobs[c].bo_handles = (uintptr_t)commandBuffer->handlesCl.buffer;
+		jobs[c].bo_handle_count = clSize(&commandBuffer->handlesCl) / 4;
+		jobs[c].bin_cl += (uintptr_t)commandBuffer->binCl.buffer;
+		jobs[c].shader_rec += (uintptr_t)commandBuffer->shaderRecCl.buffer;
+		jobs[c].uniforms += (uintptr_t)commandBuffer->uniformsCl.buffer;
+	}
+
+	traceCommandBuffer(clSize(&commandBuffer->binCl), commandBuffer->stateBytesSaved);
 
 	commandBuffer->state = CMDBUF_STATE_EXECUTABLE;
 
 	return VK_SUCCESS;
 }
 
+//with VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT a command buffer can be submitted again while pending,
+//it stays pending until the last job of every one of those submissions was handed to the kernel
+//only the submitting thread writes the state, the submit thread just counts down
+static void commandBufferSubmit(_commandBuffer* cb)
+{
+	assert(cb->state == CMDBUF_STATE_EXECUTABLE);
+	assert(!commandBufferIsPending(cb) || (cb->usageFlags & VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT));
+
+	atomic_fetch_add_explicit(&cb->numPendingSubmits, 1, memory_order_relaxed);
+
+	if(cb->usageFlags & VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT)
+	{
+		cb->state = CMDBUF_STATE_INVALID;
+	}
+}
+
+//the last job of one submission of the command buffer was submitted, the kernel has its own copy of the CLs
+static void commandBufferRetire(_commandBuffer* cb)
+{
+	atomic_fetch_sub_explicit(&cb->numPendingSubmits, 1, memory_order_release);
+}
+
+uint32_t commandBufferIsPending(VkCommandBuffer cb)
+{
+	return atomic_load_explicit(&cb->numPendingSubmits, memory_order_acquire) != 0;
+}
+
+//defaults, then VkRpiQueueThrottleCreateInfo on the device and on the queue, then the environment
+void queueInitThrottle(_queue* q, const VkDeviceCreateInfo* pCreateInfo, const VkDeviceQueueCreateInfo* pQueueCreateInfo)
+{
+	assert(q);
+
+	q->maxJobsInFlight = QUEUE_DEFAULT_MAX_JOBS_IN_FLIGHT;
+	q->latencyBudget = 0;
+
+	const void* chains[] = { pCreateInfo->pNext, pQueueCreateInfo->pNext };
+	for(uint32_t c = 0; c < 2; ++c)
+	{
+		for(const VkRpiQueueThrottleCreateInfo* next = chains[c]; next; next = next->pNext)
+		{
+			if(next->sType == VK_STRUCTURE_TYPE_RPI_QUEUE_THROTTLE_CREATE_INFO)
+			{
+				if(next->maxJobsInFlight)
+				{
+					q->maxJobsInFlight = next->maxJobsInFlight;
+				}
+				q->latencyBudget = (uint64_t)next->latencyBudgetUs * 1000;
+			}
+		}
+	}
+
+	const char* maxJobs = getenv("RPI_VK_MAX_JOBS_IN_FLIGHT");
+	if(maxJobs && atoi(maxJobs) > 0)
+	{
+		q->maxJobsInFlight = atoi(maxJobs);
+	}
+
+	const char* budget = getenv("RPI_VK_LATENCY_BUDGET_US");
+	if(budget)
+	{
+		q->latencyBudget = strtoull(budget, 0, 10) * 1000;
+	}
+
+	q->jobsInFlightLimit = q->maxJobsInFlight;
+	q->lastFinishedSeqno = 0;
+	q->lastFinishTime = 0;
+	q->avgJobTime = 0;
+	memset(q->submitTimes, 0, sizeof(q->submitTimes));
+}
+
+//blocks the submit thread while too many jobs are in flight
+//with a latency budget the limit follows the measured job time, so a job submitted now finishes within the budget
+//seqnos are shared with other clients of the GPU, so their jobs count as in flight too
+static void queueThrottle(_queue* q)
+{
+	q->submitTimes[q->lastEmitSeqno % QUEUE_JOB_TIME_HISTORY].seqno = q->lastEmitSeqno;
+	q->submitTimes[q->lastEmitSeqno % QUEUE_JOB_TIME_HISTORY].time = vc4_time_ns();
+
+	q->lastFinishedSeqno = max(q->lastFinishedSeqno, vc4_last_finished_seqno());
+	if(q->lastEmitSeqno - q->lastFinishedSeqno <= q->jobsInFlightLimit)
+	{
+		return;
+	}
+
+	uint64_t seqno = q->lastEmitSeqno - q->jobsInFlightLimit;
+	uint64_t timeout = WAIT_TIMEOUT_INFINITE;
+	if(vc4_seqno_wait(controlFd, &q->lastFinishedSeqno, seqno, &timeout) <= 0)
+	{
+		printf("Job throttling failed\n");
+		return;
+	}
+
+	if(!q->latencyBudget)
+	{
+		return;
+	}
+
+	//the GPU was busy while we waited, so the job ran from when the one before it finished, or from its submission
+	uint64_t now = vc4_time_ns();
+	_jobSubmitTime* submitted = &q->submitTimes[seqno % QUEUE_JOB_TIME_HISTORY];
+	uint64_t start = q->lastFinishTime;
+	if(submitted->seqno == seqno)
+	{
+		start = max(start, submitted->time);
+	}
+	q->lastFinishTime = now;
+
+	if(start && now > start)
+	{
+		uint64_t jobTime = now - start;
+		q->avgJobTime = q->avgJobTime ? (q->avgJobTime * 7 + jobTime) / 8 : jobTime;
+
+		uint64_t limit = q->latencyBudget / q->avgJobTime;
+		q->jobsInFlightLimit = limit < 1 ? 1 : min(limit, q->maxJobsInFlight);
+	}
+}
+
+//signals s once every job submitted to the kernel so far finished
+static void queueSignalSemaphore(_queue* q, _semaphore* s)
+{
+	if(s->syncobj && q->syncobj && vc4_syncobj_copy(controlFd, s->syncobj, q->syncobj))
+	{
+		atomic_store(&s->hasFence, 1);
+		return;
+	}
+
+	//no fence to hand over, so the jobs have to finish before the semaphore is signaled on the CPU
+	uint64_t lastFinishedSeqno = 0;
+	uint64_t timeout = WAIT_TIMEOUT_INFINITE;
+	vc4_seqno_wait(controlFd, &lastFinishedSeqno, q->lastEmitSeqno, &timeout);
+	semaphoreSignal(s);
+}
+
+//runs on the queue's submit thread, blocking work (semaphore waits, throttling, the submit ioctl)
+//is done here so vkQueueSubmit can return as soon as the jobs are queued
+static void* queueSubmitThreadFunc(void* arg)
+{
+	_queue* q = arg;
+
+	for(;;)
+	{
+		_submitJob job;
+
+		sem_wait(&q->jobsAvailable);
+		if(!spscQueuePop(&q->jobs, &job))
+		{
+			assert(0); //jobsAvailable counts the jobs in the queue
+			continue;
+		}
+		sem_post(&q->slotsAvailable);
+
+		switch(job.type)
+		{
+		case SUBMIT_JOB_WAIT_SEMAPHORE:
+			semaphoreWait(job.semaphore);
+			break;
+		case SUBMIT_JOB_SUBMIT_CL:
+		{
+			//the kernel writes the seqno back, and the sync objects differ between submits
+			struct drm_vc4_submit_cl submitCl = *job.submitCl;
+
+			if(job.inSync)
+			{
+				if(atomic_load(&job.inSync->hasFence))
+				{
+					submitCl.in_sync = job.inSync->syncobj;
+				}
+				else
+				{
+					//signaled by a submit that hasn't reached the kernel yet, eg. on another queue
+					semaphoreWait(job.inSync);
+					job.inSync = 0;
+				}
+			}
+
+			//the queue's syncobj tracks every job, signal semaphores copy its fence
+			submitCl.out_sync = job.outSync ? job.outSync->syncobj : q->syncobj;
+
+			//submit ioctl
+			uint64_t lastEmitSeqno = q->lastEmitSeqno;
+			vc4_cl_submit(controlFd, &submitCl, &q->lastEmitSeqno);
+			if(q->lastEmitSeqno != lastEmitSeqno)
+			{
+				queueThrottle(q);
+			}
+
+			//the kernel consumed the wait, the semaphore is unsignaled again
+			if(job.inSync)
+			{
+				atomic_store(&job.inSync->hasFence, 0);
+				vc4_syncobj_reset(controlFd, &job.inSync->syncobj, 1);
+			}
+
+			if(job.outSync)
+			{
+				//copied before anyone can wait on the semaphore and reset it
+				if(q->syncobj)
+				{
+					vc4_syncobj_copy(controlFd, q->syncobj, job.outSync->syncobj);
+				}
+				atomic_store(&job.outSync->hasFence, 1);
+			}
+
+			if(traceEnabled(TRACE_SUBMIT))
+			{
+				traceSubmit(&submitCl);
+			}
+
+			if(job.cmdbuf)
+			{
+				commandBufferRetire(job.cmdbuf);
+			}
+			break;
+		}
+		case SUBMIT_JOB_SIGNAL_SEMAPHORE:
+			queueSignalSemaphore(q, job.semaphore);
+			break;
+		case SUBMIT_JOB_WAIT_TIMELINE:
+			timelineWaitSubmitted(job.semaphore, job.value);
+			break;
+		case SUBMIT_JOB_SIGNAL_TIMELINE:
+			timelineSignalSeqno(job.semaphore, job.value, q->lastEmitSeqno);
+			break;
+		case SUBMIT_JOB_SIGNAL_FENCE:
+			//jobs finish in order, so the fence signals once the queue's last job does
+			//waiters read this after seeing numJobsDone advance under idleMutex
+			job.fence->seqno = q->lastEmitSeqno;
+			break;
+		case SUBMIT_JOB_QUIT:
+			return 0;
+		}
+
+		pthread_mutex_lock(&q->idleMutex);
+		q->numJobsDone++;
+		pthread_cond_broadcast(&q->idleCond);
+		pthread_mutex_unlock(&q->idleMutex);
+	}
+}
+
+//jobMem must hold QUEUE_MAX_SUBMIT_JOBS jobs, it is owned by the caller
+uint32_t queueStartSubmitThread(_queue* q, void* jobMem)
+{
+	assert(q);
+	assert(jobMem);
+
+	q->jobs = createSPSCQueue(jobMem, sizeof(_submitJob), sizeof(_submitJob) * QUEUE_MAX_SUBMIT_JOBS);
+	q->numJobsQueued = 0;
+	q->numJobsDone = 0;
+
+	//created signaled, nothing was submitted yet
+	q->syncobj = q->dev->dev->instance->hasSyncobj ? vc4_syncobj_create(controlFd, 1) : 0;
+
+	sem_init(&q->jobsAvailable, 0, 0);
+	sem_init(&q->slotsAvailable, 0, QUEUE_MAX_SUBMIT_JOBS);
+	pthread_mutex_init(&q->idleMutex, 0);
+
+	//timed waits are against CLOCK_MONOTONIC, like the seqno waits
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&q->idleCond, &attr);
+	pthread_condattr_destroy(&attr);
+
+	if(pthread_create(&q->submitThread, 0, queueSubmitThreadFunc, q))
+	{
+		//nothing to stop, undo the rest
+		if(q->syncobj)
+		{
+			vc4_syncobj_destroy(controlFd, q->syncobj);
+		}
+		pthread_cond_destroy(&q->idleCond);
+		pthread_mutex_destroy(&q->idleMutex);
+		sem_destroy(&q->slotsAvailable);
+		sem_destroy(&q->jobsAvailable);
+		destroySPSCQueue(&q->jobs);
+		return 0;
+	}
+
+	return 1;
+}
+
+static void queuePushJob(_queue* q, const _submitJob* job)
+{
+	sem_wait(&q->slotsAvailable);
+	if(!spscQueuePush(&q->jobs, job))
+	{
+		assert(0); //slotsAvailable counts the free slots
+		return;
+	}
+	q->numJobsQueued++;
+	sem_post(&q->jobsAvailable);
+}
+
+//blocks until the submit thread processed the first numJobs jobs or the CLOCK_MONOTONIC deadline passed
+//returns whether the jobs were processed
+uint32_t queueWaitForJobs(_queue* q, uint64_t numJobs, uint64_t deadline)
+{
+	assert(q);
+
+	pthread_mutex_lock(&q->idleMutex);
+	while(q->numJobsDone < numJobs)
+	{
+		if(deadline == WAIT_TIMEOUT_INFINITE)
+		{
+			pthread_cond_wait(&q->idleCond, &q->idleMutex);
+			continue;
+		}
+
+		if(vc4_time_ns() >= deadline)
+		{
+			break;
+		}
+
+		struct timespec ts = { .tv_sec = deadline / 1000000000ull, .tv_nsec = deadline % 1000000000ull };
+		pthread_cond_timedwait(&q->idleCond, &q->idleMutex, &ts);
+	}
+	uint32_t done = q->numJobsDone >= numJobs;
+	pthread_mutex_unlock(&q->idleMutex);
+
+	return done;
+}
+
+//non-blocking version of queueWaitForJobs
+uint32_t queueJobsDone(_queue* q, uint64_t numJobs)
+{
+	assert(q);
+
+	pthread_mutex_lock(&q->idleMutex);
+	uint32_t done = q->numJobsDone >= numJobs;
+	pthread_mutex_unlock(&q->idleMutex);
+
+	return done;
+}
+
+//blocks until the submit thread processed every job queued so far
+void queueWaitForSubmitThread(_queue* q)
+{
+	queueWaitForJobs(q, q->numJobsQueued, WAIT_TIMEOUT_INFINITE);
+}
+
+void queueStopSubmitThread(_queue* q)
+{
+	assert(q);
+
+	_submitJob job = { .type = SUBMIT_JOB_QUIT };
+	queuePushJob(q, &job);
+	pthread_join(q->submitThread, 0);
+
+	if(q->syncobj)
+	{
+		vc4_syncobj_destroy(controlFd, q->syncobj);
+	}
+
+	pthread_cond_destroy(&q->idleCond);
+	pthread_mutex_destroy(&q->idleMutex);
+	sem_destroy(&q->slotsAvailable);
+	sem_destroy(&q->jobsAvailable);
+	destroySPSCQueue(&q->jobs);
+}
+
+//queue the jobs of one batch: waits, then the render pass jobs of every command buffer, then signals
+static void queueSubmitBatch(_queue* q, const VkSubmitInfo* pSubmit)
+{
+	const VkTimelineSemaphoreSubmitInfoKHR* timelineInfo = 0;
+	for(const VkTimelineSemaphoreSubmitInfoKHR* next = pSubmit->pNext; next; next = next->pNext)
+	{
+		if(next->sType == VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR)
+		{
+			timelineInfo = next;
+		}
+	}
+
+	uint32_t numBatchJobs = 0;
+	for(int c = 0; c < pSubmit->commandBufferCount; ++c)
+	{
+		numBatchJobs += pSubmit->pCommandBuffers[c]->numJobs;
+	}
+
+	//with syncobjs the kernel waits on the first wait semaphore before the batch's first job
+	//and signals the first binary signal semaphore when its last job completes
+	_semaphore* inSync = 0;
+	_semaphore* outSync = 0;
+	if(numBatchJobs && q->dev->dev->instance->hasSyncobj)
+	{
+		if(pSubmit->waitSemaphoreCount && ((_semaphore*)pSubmit->pWaitSemaphores[0])->syncobj)
+		{
+			inSync = pSubmit->pWaitSemaphores[0];
+		}
+
+		for(int c = 0; c < pSubmit->signalSemaphoreCount && !outSync; ++c)
+		{
+			if(((_semaphore*)pSubmit->pSignalSemaphores[c])->syncobj)
+			{
+				outSync = pSubmit->pSignalSemaphores[c];
+			}
+		}
+	}
+
+	//jobs are executed in order by the submit thread
+	for(int c = inSync ? 1 : 0; c < pSubmit->waitSemaphoreCount; ++c)
+	{
+		_submitJob job = { .type = SUBMIT_JOB_WAIT_SEMAPHORE, .semaphore = pSubmit->pWaitSemaphores[c] };
+		if(job.semaphore->isTimeline)
+		{
+			assert(timelineInfo && c < timelineInfo->waitSemaphoreValueCount);
+			job.type = SUBMIT_JOB_WAIT_TIMELINE;
+			job.value = timelineInfo->pWaitSemaphoreValues[c];
+		}
+		queuePushJob(q, &job);
+	}
+
+	uint32_t batchJob = 0;
+
+	//TODO: deal with pSubmit->pWaitDstStageMask
+
+	for(int c = 0; c < pSubmit->commandBufferCount; ++c)
+	{
+		VkCommandBuffer cmdbuf = pSubmit->pCommandBuffers[c];
+
+		commandBufferSubmit(cmdbuf);
+
+		//no render pass was recorded, so there is no job to submit
+		if(!cmdbuf->numJobs)
+		{
+			commandBufferRetire(cmdbuf);
+			continue;
+		}
+
+		//one vc4 job per render pass, submitted back to back, already finalized by vkEndCommandBuffer
+		const struct drm_vc4_submit_cl* jobs = (const struct drm_vc4_submit_cl*)cmdbuf->jobsCl.buffer;
+		for(uint32_t d = 0; d < cmdbuf->numJobs; ++d)
+		{
+			//the command buffer leaves the pending state once its last job is submitted
+			_submitJob job = { .type = SUBMIT_JOB_SUBMIT_CL, .cmdbuf = d == cmdbuf->numJobs - 1 ? cmdbuf : 0, .submitCl = &jobs[d] };
+			job.inSync = batchJob == 0 ? inSync : 0;
+			job.outSync = batchJob == numBatchJobs - 1 ? outSync : 0;
+			batchJob++;
+
+			queuePushJob(q, &job);
+		}
+	}
+
+	//the other signal semaphores get the fence of the queue's last job,
+	//which is the batch's last job or, for a batch without jobs, the one submitted before it
+	for(int c = 0; c < pSubmit->signalSemaphoreCount; ++c)
+	{
+		_submitJob job = { .type = SUBMIT_JOB_SIGNAL_SEMAPHORE, .semaphore = pSubmit->pSignalSemaphores[c] };
+		if(job.semaphore == outSync)
+		{
+			continue;
+		}
+
+		if(job.semaphore->isTimeline)
+		{
+			assert(timelineInfo && c < timelineInfo->signalSemaphoreValueCount);
+			job.type = SUBMIT_JOB_SIGNAL_TIMELINE;
+			job.value = timelineInfo->pSignalSemaphoreValues[c];
+		}
+		queuePushJob(q, &job);
+	}
+}
+
 /*
  * https://www.khronos.org/registry/vulkan/specs/1.1-extensions/html/vkspec.html#vkQueueSubmit
  * vkQueueSubmit is a queue submission command, with each batch defined by an element of pSubmits as an instance of the VkSubmitInfo structure.
@@ -280,82 +909,26 @@ VKAPI_ATTR VkResult VKAPI_CALL vkQueueSubmit(
 		VkFence                                     fence)
 {
 	assert(queue);
+	assert(!submitCount || pSubmits);
 
-	for(int c = 0; c < pSubmits->waitSemaphoreCount; ++c)
-	{
-		sem_wait((sem_t*)pSubmits->pWaitSemaphores[c]);
-	}
-
-	//TODO: deal with pSubmits->pWaitDstStageMask
-
-	//TODO wait for fence??
-
-	for(int c = 0; c < pSubmits->commandBufferCount; ++c)
-	{
-		if(pSubmits->pCommandBuffers[c]->state == CMDBUF_STATE_EXECUTABLE)
-		{
-			pSubmits->pCommandBuffers[c]->state = CMDBUF_STATE_PENDING;
-		}
-	}
-
-	for(int c = 0; c < pSubmits->commandBufferCount; ++c)
-	{
-		VkCommandBuffer cmdbuf = pSubmits->pCommandBuffers[c];
-
-		cmdbuf->submitCl.bo_handles = cmdbuf->handlesCl.buffer;
-		cmdbuf->submitCl.bo_handle_count = clSize(&cmdbuf->handlesCl) / 4;
-		cmdbuf->submitCl.bin_cl = cmdbuf->binCl.buffer;
-		cmdbuf->submitCl.bin_cl_size = clSize(&cmdbuf->binCl);
-		cmdbuf->submitCl.shader_rec = cmdbuf->shaderRecCl.buffer;
-		cmdbuf->submitCl.shader_rec_size = clSize(&cmdbuf->shaderRecCl);
-		cmdbuf->submitCl.shader_rec_count = cmdbuf->shaderRecCount;
-		cmdbuf->submitCl.uniforms = cmdbuf->uniformsCl.buffer;
-		cmdbuf->submitCl.uniforms_size = clSize(&cmdbuf->uniformsCl);
-
-		printf("BCL:\n");
-		clDump(cmdbuf->submitCl.bin_cl, cmdbuf->submitCl.bin_cl_size);
-		printf("BO handles: ");
-		for(int d = 0; d < cmdbuf->submitCl.bo_handle_count; ++d)
-		{
-			printf("%u ", *((uint32_t*)(cmdbuf->submitCl.bo_handles)+d));
-		}
-		printf("\nwidth height: %u, %u\n", cmdbuf->submitCl.width, cmdbuf->submitCl.height);
-		printf("tile min/max: %u,%u %u,%u\n", cmdbuf->submitCl.min_x_tile, cmdbuf->submitCl.min_y_tile, cmdbuf->submitCl.max_x_tile, cmdbuf->submitCl.max_y_tile);
-		printf("color read surf: hindex, offset, bits, flags %u %u %u %u\n", cmdbuf->submitCl.color_read.hindex, cmdbuf->submitCl.color_read.offset, cmdbuf->submitCl.color_read.bits, cmdbuf->submitCl.color_read.flags);
-		printf("color write surf: hindex, offset, bits, flags %u %u %u %u\n", cmdbuf->submitCl.color_write.hindex, cmdbuf->submitCl.color_write.offset, cmdbuf->submitCl.color_write.bits, cmdbuf->submitCl.color_write.flags);
-		printf("zs read surf: hindex, offset, bits, flags %u %u %u %u\n", cmdbuf->submitCl.zs_read.hindex, cmdbuf->submitCl.zs_read.offset, cmdbuf->submitCl.zs_read.bits, cmdbuf->submitCl.zs_read.flags);
-		printf("zs write surf: hindex, offset, bits, flags %u %u %u %u\n", cmdbuf->submitCl.zs_write.hindex, cmdbuf->submitCl.zs_write.offset, cmdbuf->submitCl.zs_write.bits, cmdbuf->submitCl.zs_write.flags);
-		printf("msaa color write surf: hindex, offset, bits, flags %u %u %u %u\n", cmdbuf->submitCl.msaa_color_write.hindex, cmdbuf->submitCl.msaa_color_write.offset, cmdbuf->submitCl.msaa_color_write.bits, cmdbuf->submitCl.msaa_color_write.flags);
-		printf("msaa zs write surf: hindex, offset, bits, flags %u %u %u %u\n", cmdbuf->submitCl.msaa_zs_write.hindex, cmdbuf->submitCl.msaa_zs_write.offset, cmdbuf->submitCl.msaa_zs_write.bits, cmdbuf->submitCl.msaa_zs_write.flags);
-		printf("clear color packed rgba %u %u\n", cmdbuf->submitCl.clear_color[0], cmdbuf->submitCl.clear_color[1]);
-		printf("clear z %u\n", cmdbuf->submitCl.clear_z);
-		printf("clear s %u\n", cmdbuf->submitCl.clear_s);
-		printf("flags %u\n", cmdbuf->submitCl.flags);
-
+	_queue* q = queue;
 
-		//submit ioctl
-		static uint64_t lastFinishedSeqno = 0;
-		vc4_cl_submit(controlFd, &cmdbuf->submitCl, &queue->lastEmitSeqno, &lastFinishedSeqno);
-	}
-
-	for(int c = 0; c < pSubmits->commandBufferCount; ++c)
+	//batches are queued back to back, the submit thread runs them in order
+	for(uint32_t c = 0; c < submitCount; ++c)
 	{
-		if(pSubmits->pCommandBuffers[c]->state == CMDBUF_STATE_PENDING)
-		{
-			if(pSubmits->pCommandBuffers[c]->usageFlags & VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT)
-			{
-				pSubmits->pCommandBuffers[c]->state = CMDBUF_STATE_INVALID;
-			}
-			else
-			{
-				pSubmits->pCommandBuffers[c]->state = CMDBUF_STATE_EXECUTABLE;
-			}
-		}
+		queueSubmitBatch(q, &pSubmits[c]);
 	}
 
-	for(int c = 0; c < pSubmits->signalSemaphoreCount; ++c)
+	if(fence)
 	{
-		sem_post((sem_t*)pSubmits->pSignalSemaphores[c]);
+		_fence* f = fence;
+		f->signaled = 0;
+		f->seqno = 0;
+		f->queue = q;
+
+		_submitJob job = { .type = SUBMIT_JOB_SIGNAL_FENCE, .fence = f };
+		queuePushJob(q, &job);
+		f->jobIndex = q->numJobsQueued;
 	}
 
 	return VK_SUCCESS;
@@ -379,13 +952,17 @@ VKAPI_ATTR void VKAPI_CALL vkFreeCommandBuffers(
 
 	for(int c = 0; c < commandBufferCount; ++c)
 	{
+		if(!pCommandBuffers[c])
+		{
+			continue;
+		}
+
+		assert(!commandBufferIsPending(pCommandBuffers[c]));
+
 		//if(cp->usePoolAllocator)
 		{
-			consecutivePoolFree(&cp->cpa, &pCommandBuffers[c]->binCl, pCommandBuffers[c]->binCl.numBlocks);
-			consecutivePoolFree(&cp->cpa, &pCommandBuffers[c]->handlesCl, pCommandBuffers[c]->binCl.numBlocks);
-			consecutivePoolFree(&cp->cpa, &pCommandBuffers[c]->shaderRecCl, pCommandBuffers[c]->binCl.numBlocks);
-			consecutivePoolFree(&cp->cpa, &pCommandBuffers[c]->uniformsCl, pCommandBuffers[c]->binCl.numBlocks);
-			poolFree(&cp->pa, pCommandBuffers[c]);
+			commandPoolFreeControlLists(cp, pCommandBuffers[c]);
+			commandPoolFreeCommandBuffer(cp, pCommandBuffers[c]);
 		}
 	}
 }
@@ -408,10 +985,21 @@ VKAPI_ATTR void VKAPI_CALL vkDestroyCommandPool(
 
 	//if(cp->usePoolAllocator)
 	{
-		FREE(cp->pa.buf);
-		FREE(cp->cpa.buf);
-		destroyPoolAllocator(&cp->pa);
-		destroyConsecutivePoolAllocator(&cp->cpa);
+		while(cp->commandBufferSlabs)
+		{
+			_commandBufferSlab* slab = cp->commandBufferSlabs;
+			cp->commandBufferSlabs = slab->next;
+			destroyPoolAllocator(&slab->pa);
+			commandPoolFreeHost(cp, slab);
+		}
+
+		while(cp->controlListSlabs)
+		{
+			_controlListSlab* slab = cp->controlListSlabs;
+			cp->controlListSlabs = slab->next;
+			destroyConsecutivePoolAllocator(&slab->cpa, cp->hasAllocator ? &cp->allocator : 0);
+			commandPoolFreeHost(cp, slab);
+		}
 	}
 
 	FREE(cp);
@@ -430,7 +1018,38 @@ VKAPI_ATTR void VKAPI_CALL vkTrimCommandPool(
 
 	_commandPool* cp = commandPool;
 
-	//TODO??
+	//release every slab that has nothing allocated from it
+	for(_commandBufferSlab** slab = &cp->commandBufferSlabs; *slab;)
+	{
+		if((*slab)->numAllocations)
+		{
+			slab = &(*slab)->next;
+			continue;
+		}
+
+		_commandBufferSlab* emptySlab = *slab;
+		*slab = emptySlab->next;
+		destroyPoolAllocator(&emptySlab->pa);
+		commandPoolFreeHost(cp, emptySlab);
+	}
+
+	for(_controlListSlab** slab = &cp->controlListSlabs; *slab;)
+	{
+		if((*slab)->numAllocations)
+		{
+			slab = &(*slab)->next;
+			continue;
+		}
+
+		_controlListSlab* emptySlab = *slab;
+		*slab = emptySlab->next;
+		destroyConsecutivePoolAllocator(&emptySlab->cpa, cp->hasAllocator ? &cp->allocator : 0);
+		commandPoolFreeHost(cp, emptySlab);
+	}
+
+	//growth starts over from small slabs
+	cp->nextCommandBufferSlabSize = COMMAND_POOL_MIN_COMMAND_BUFFERS;
+	cp->nextControlListSlabSize = COMMAND_POOL_MIN_CL_SIZE;
 }
 
 /*
@@ -446,29 +1065,26 @@ VKAPI_ATTR VkResult VKAPI_CALL vkResetCommandPool(
 
 	_commandPool* cp = commandPool;
 
-	for(char* c = cp->pa.buf; c != cp->pa.buf + cp->pa.size; c += cp->pa.blockSize)
+	for(_commandBufferSlab* slab = cp->commandBufferSlabs; slab; slab = slab->next)
 	{
-		char* d = cp->pa.nextFreeBlock;
-		while(d)
+		for(char* c = slab->pa.buf; c != slab->pa.buf + slab->pa.size; c += slab->pa.blockSize)
 		{
-			if(c == d) break;
-		}
+			_commandBuffer* cb = (_commandBuffer*)c;
 
-		if(c == d) //block is free, as we found it in the free chain
-		{
-			continue;
-		}
-		else
-		{
-			//we found a valid block
-			_commandBuffer* cb = c;
-			assert(cb->state != CMDBUF_STATE_PENDING);
+			if(cb->cp != cp) //block is free
+			{
+				continue;
+			}
+
+			assert(!commandBufferIsPending(cb));
 			cb->state = CMDBUF_STATE_INITIAL;
 		}
 	}
 
 	//TODO secondary command buffer stuff
 	//TODO reset flag
+
+	return VK_SUCCESS;
 }
 
 /*
@@ -482,7 +1098,7 @@ VKAPI_ATTR VkResult VKAPI_CALL vkResetCommandBuffer(
 
 	_commandBuffer* cb = commandBuffer;
 
-	assert(cb->state != CMDBUF_STATE_PENDING);
+	assert(!commandBufferIsPending(cb));
 
 	if(cb->state == CMDBUF_STATE_RECORDING || cb->state == CMDBUF_STATE_EXECUTABLE)
 	{
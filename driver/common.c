@@ -12,7 +12,8 @@ uint32_t getFormatBpp(VkFormat f)
 		return 64;
 	case VK_FORMAT_R8G8B8_UNORM: //padded to 32
 	case VK_FORMAT_R8G8B8A8_UNORM:
-		return 32;
+	case VK_FORMAT_X8_D24_UNORM_PACK32: //the tile buffer only stores 24 bit depth with 8 bit stencil
+	case VK_FORMAT_D24_UNORM_S8_UINT:
 		return 32;
 	case VK_FORMAT_R5G5B5A1_UNORM_PACK16:
 	case VK_FORMAT_R4G4B4A4_UNORM_PACK16:
@@ -268,6 +269,26 @@ int isDepthStencilFormat(VkFormat format)
 	}
 }
 
+//depth and/or stencil aspect bits of a depth/stencil format, 0 for anything else
+VkImageAspectFlags getDepthStencilAspects(VkFormat format)
+{
+	switch(format)
+	{
+	case VK_FORMAT_D16_UNORM:
+	case VK_FORMAT_X8_D24_UNORM_PACK32:
+	case VK_FORMAT_D32_SFLOAT:
+		return VK_IMAGE_ASPECT_DEPTH_BIT;
+	case VK_FORMAT_S8_UINT:
+		return VK_IMAGE_ASPECT_STENCIL_BIT;
+	case VK_FORMAT_D16_UNORM_S8_UINT:
+	case VK_FORMAT_D24_UNORM_S8_UINT:
+	case VK_FORMAT_D32_SFLOAT_S8_UINT:
+		return VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT;
+	default:
+		return 0;
+	}
+}
+
 uint32_t getDepthCompareOp(VkCompareOp op)
 {
 	switch(op)
@@ -366,14 +387,124 @@ uint32_t ulog2(uint32_t v)
 
 void clFit(VkCommandBuffer cb, ControlList* cl, uint32_t commandSize)
 {
-	if(!clHasEnoughSpace(cl, commandSize))
+	if(cl->currentChunk)
 	{
-		uint32_t currSize = clSize(cl);
-		cl->buffer = consecutivePoolReAllocate(&cb->cp->cpa, cl->buffer, cl->numBlocks); assert(cl->buffer);
+		//chunked lists never move, a command that doesn't fit starts the next chunk
+		if(cl->nextFreeByte + commandSize > (uint8_t*)cl->currentChunk + cl->numBlocks * COMMAND_POOL_BLOCK_SIZE)
+		{
+			uint32_t numBlocks = min(cl->numBlocks * 2, CONTROL_LIST_MAX_CHUNK_BLOCKS);
+			assert(commandSize <= numBlocks * COMMAND_POOL_BLOCK_SIZE - sizeof(ControlListChunk));
+			ControlListChunk* chunk = commandPoolAllocate(cb->cp, numBlocks); assert(chunk);
+			chunk->numBlocks = numBlocks;
+			clStartChunk(cl, chunk);
+		}
+		return;
+	}
+
+	uint32_t currSize = clSize(cl);
+	while(currSize + commandSize > cl->numBlocks * COMMAND_POOL_BLOCK_SIZE)
+	{
+		cl->buffer = commandPoolReAllocate(cb->cp, cl->buffer, cl->numBlocks); assert(cl->buffer);
+		cl->numBlocks++;
 		cl->nextFreeByte = cl->buffer + currSize;
 	}
 }
 
+//copy a chunked control list into one contiguous allocation so it can be submitted
+//the chunks are freed except the first one, which is reused by clReset
+//returns 0 if out of memory
+uint32_t clFlatten(VkCommandBuffer cb, ControlList* cl)
+{
+	assert(cl->currentChunk);
+
+	if(cl->currentChunk == cl->firstChunk)
+	{
+		//a single chunk is contiguous already
+		return 1;
+	}
+
+	cl->currentChunk->size = clSize(cl);
+
+	uint32_t size = 0;
+	for(ControlListChunk* c = cl->firstChunk; c; c = c->next)
+	{
+		size += c->size;
+	}
+
+	uint32_t numBlocks = divRoundUp(size, COMMAND_POOL_BLOCK_SIZE);
+	uint8_t* flat = commandPoolAllocate(cb->cp, numBlocks);
+	if(!flat)
+	{
+		return 0;
+	}
+
+	uint8_t* dst = flat;
+	ControlListChunk* c = cl->firstChunk;
+	memcpy(dst, c + 1, c->size);
+	dst += c->size;
+	c = c->next;
+	while(c)
+	{
+		ControlListChunk* next = c->next;
+		memcpy(dst, c + 1, c->size);
+		dst += c->size;
+		commandPoolFree(cb->cp, c, c->numBlocks);
+		c = next;
+	}
+
+	cl->firstChunk->next = 0;
+	cl->currentChunk = 0;
+	cl->buffer = flat;
+	cl->numBlocks = numBlocks;
+	cl->nextFreeByte = flat + size;
+
+	return 1;
+}
+
+//size of all commands in the list, including the previous chunks of a chunked list
+uint32_t clTotalSize(ControlList* cl)
+{
+	uint32_t size = clSize(cl);
+
+	if(cl->currentChunk)
+	{
+		for(ControlListChunk* c = cl->firstChunk; c != cl->currentChunk; c = c->next)
+		{
+			size += c->size;
+		}
+	}
+
+	return size;
+}
+
+//empty a control list for recording again, chunked lists go back to their first chunk
+void clReset(VkCommandBuffer cb, ControlList* cl)
+{
+	if(!cl->firstChunk)
+	{
+		cl->nextFreeByte = cl->buffer;
+		return;
+	}
+
+	if(!cl->currentChunk)
+	{
+		//drop the flattened copy
+		commandPoolFree(cb->cp, cl->buffer, cl->numBlocks);
+	}
+	else
+	{
+		ControlListChunk* c = cl->firstChunk->next;
+		while(c)
+		{
+			ControlListChunk* next = c->next;
+			commandPoolFree(cb->cp, c, c->numBlocks);
+			c = next;
+		}
+	}
+
+	clInitChunked(cl, cl->firstChunk, cl->firstChunk->numBlocks);
+}
+
 void clDump(void* cl, uint32_t size)
 {
 		struct v3d_device_info devinfo = {
@@ -555,18 +686,6 @@ VKAPI_ATTR void VKAPI_CALL vkCmdPushConstants(
 
 }
 
-VKAPI_ATTR void VKAPI_CALL vkCmdResolveImage(
-	VkCommandBuffer                             commandBuffer,
-	VkImage                                     srcImage,
-	VkImageLayout                               srcImageLayout,
-	VkImage                                     dstImage,
-	VkImageLayout                               dstImageLayout,
-	uint32_t                                    regionCount,
-	const VkImageResolve*                       pRegions)
-{
-
-}
-
 VKAPI_ATTR VkResult VKAPI_CALL vkGetPhysicalDeviceImageFormatProperties(
 	VkPhysicalDevice                            physicalDevice,
 	VkFormat                                    format,
@@ -891,14 +1010,6 @@ VKAPI_ATTR void VKAPI_CALL vkCmdSetEvent(
 
 }
 
-VKAPI_ATTR void VKAPI_CALL vkGetDeviceMemoryCommitment(
-	VkDevice                                    device,
-	VkDeviceMemory                              memory,
-	VkDeviceSize*                               pCommittedMemoryInBytes)
-{
-
-}
-
 VKAPI_ATTR VkResult VKAPI_CALL vkCreatePipelineCache(
 	VkDevice                                    device,
 	const VkPipelineCacheCreateInfo*            pCreateInfo,
@@ -967,14 +1078,37 @@ VKAPI_ATTR void VKAPI_CALL vkGetPhysicalDeviceFeatures2(
 	VkPhysicalDevice                            physicalDevice,
 	VkPhysicalDeviceFeatures2*                  pFeatures)
 {
+	assert(physicalDevice);
+	assert(pFeatures);
+
+	vkGetPhysicalDeviceFeatures(physicalDevice, &pFeatures->features);
 
+	for(VkPhysicalDeviceTimelineSemaphoreFeaturesKHR* next = pFeatures->pNext; next; next = next->pNext)
+	{
+		if(next->sType == VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR)
+		{
+			next->timelineSemaphore = VK_TRUE;
+		}
+	}
 }
 
 VKAPI_ATTR void VKAPI_CALL vkGetPhysicalDeviceProperties2(
 	VkPhysicalDevice                            physicalDevice,
 	VkPhysicalDeviceProperties2*                pProperties)
 {
+	assert(physicalDevice);
+	assert(pProperties);
 
+	vkGetPhysicalDeviceProperties(physicalDevice, &pProperties->properties);
+
+	for(VkPhysicalDeviceTimelineSemaphorePropertiesKHR* next = pProperties->pNext; next; next = next->pNext)
+	{
+		if(next->sType == VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_PROPERTIES_KHR)
+		{
+			//values are only compared against seqno-backed points, so there is no limit
+			next->maxTimelineSemaphoreValueDifference = UINT64_MAX;
+		}
+	}
 }
 
 VKAPI_ATTR void VKAPI_CALL vkGetPhysicalDeviceFormatProperties2(
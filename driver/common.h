@@ -10,7 +10,9 @@
 #include "AlignedAllocator.h"
 #include "PoolAllocator.h"
 #include "ConsecutivePoolAllocator.h"
+#include "OffsetAllocator.h"
 #include "LinearAllocator.h"
+#include "SPSCQueue.h"
 
 #include <stdio.h>
 #include "CustomAssert.h"
@@ -20,8 +22,10 @@
 #include <stdint.h>
 #include <pthread.h>
 #include <semaphore.h>
+#include <stdatomic.h>
 
 #include "kernelInterface.h"
+#include "Tracer.h"
 #include "ControlListUtil.h"
 
 #ifndef min
@@ -48,17 +52,127 @@ VK_SYSTEM_ALLOCATION_SCOPE_INSTANCE
 
 typedef struct VkDevice_T _device;
 
+//number of jobs that can be in flight between vkQueueSubmit and the submit thread
+#define QUEUE_MAX_SUBMIT_JOBS 64
+
+typedef enum _submitJobType
+{
+	SUBMIT_JOB_WAIT_SEMAPHORE = 0,
+	SUBMIT_JOB_SUBMIT_CL,
+	SUBMIT_JOB_SIGNAL_SEMAPHORE,
+	SUBMIT_JOB_SIGNAL_FENCE,
+	SUBMIT_JOB_WAIT_TIMELINE,
+	SUBMIT_JOB_SIGNAL_TIMELINE,
+	SUBMIT_JOB_QUIT
+} _submitJobType;
+
+//timeline value that is reached once the job with seqno finishes
+typedef struct _timelinePoint
+{
+	uint64_t value;
+	uint64_t seqno;
+} _timelinePoint;
+
+//backed by a DRM syncobj so the kernel can order dependent jobs,
+//or by a host semaphore that the submit thread waits on if the kernel lacks syncobjs
+typedef struct VkSemaphore_T
+{
+	uint32_t syncobj; //0 if sem is used
+	atomic_uint hasFence; //the kernel can only wait on a syncobj that has a fence attached
+	sem_t sem;
+
+	//timeline semaphores only, everything below is protected by mutex
+	uint32_t isTimeline;
+	uint64_t value; //highest value known to be reached
+	_timelinePoint* points; //device signals that reached the kernel but might not have finished
+	uint32_t numPoints, maxPoints;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond; //broadcast when value or points change
+	VkAllocationCallbacks allocator; //points grow on the submit thread, so keep a copy
+	uint32_t hasAllocator;
+} _semaphore;
+
+//unit of work handed from vkQueueSubmit to the queue's submit thread
+typedef struct _submitJob
+{
+	uint32_t type;
+	_semaphore* semaphore;
+	uint64_t value; //of timeline semaphores
+	_semaphore* inSync; //SUBMIT_CL waits on / signals these in the kernel
+	_semaphore* outSync;
+	struct VkFence_T* fence;
+	VkCommandBuffer cmdbuf; //only set on the last job of a command buffer
+	const struct drm_vc4_submit_cl* submitCl; //finalized by vkEndCommandBuffer, immutable while the command buffer is pending
+} _submitJob;
+
+//jobs the CPU may have submitted ahead of the GPU, unless configured otherwise
+#define QUEUE_DEFAULT_MAX_JOBS_IN_FLIGHT 5
+//submit times kept to measure how long jobs take
+#define QUEUE_JOB_TIME_HISTORY 32
+
+typedef struct _jobSubmitTime
+{
+	uint64_t seqno;
+	uint64_t time;
+} _jobSubmitTime;
+
 typedef struct VkQueue_T
 {
-	uint64_t lastEmitSeqno;
+	uint64_t lastEmitSeqno; //written by the submit thread
+	uint32_t syncobj; //holds the fence of the last job submitted to the kernel, 0 without syncobjs
+
+	//throttling, only touched by the submit thread after creation
+	uint32_t maxJobsInFlight;
+	uint64_t latencyBudget; //ns, 0 to always allow maxJobsInFlight
+	uint32_t jobsInFlightLimit; //adapted to the latency budget
+	uint64_t lastFinishedSeqno;
+	uint64_t lastFinishTime;
+	uint64_t avgJobTime; //ns, running average of the jobs we had to wait for
+	_jobSubmitTime submitTimes[QUEUE_JOB_TIME_HISTORY]; //indexed by seqno
 	_device* dev;
+	SPSCQueue jobs; //app thread -> submit thread
+	sem_t jobsAvailable;
+	sem_t slotsAvailable;
+	pthread_t submitThread;
+	pthread_mutex_t idleMutex;
+	pthread_cond_t idleCond;
+	uint64_t numJobsQueued; //only touched by the app thread
+	uint64_t numJobsDone; //protected by idleMutex
 } _queue;
 
-typedef struct VkCommandPool_T
+//control list memory is handed out in blocks of this size
+#define COMMAND_POOL_BLOCK_SIZE (ARM_PAGE_SIZE >> 2)
+//slabs start small and double on each growth up to the max
+#define COMMAND_POOL_MIN_COMMAND_BUFFERS 16
+#define COMMAND_POOL_MAX_COMMAND_BUFFERS 128
+#define COMMAND_POOL_MIN_CL_SIZE (ARM_PAGE_SIZE * 16)
+#define COMMAND_POOL_MAX_CL_SIZE (ARM_PAGE_SIZE * 128)
+
+//command buffer structs, memory for the slab follows the header
+typedef struct _commandBufferSlab
 {
+	struct _commandBufferSlab* next;
+	uint32_t numAllocations; //slab is released by vkTrimCommandPool once this drops to 0
 	PoolAllocator pa;
+} _commandBufferSlab;
+
+//control list memory, memory for the slab follows the header
+typedef struct _controlListSlab
+{
+	struct _controlListSlab* next;
+	uint32_t numAllocations; //slab is released by vkTrimCommandPool once this drops to 0
 	ConsecutivePoolAllocator cpa;
+} _controlListSlab;
+
+typedef struct VkCommandPool_T
+{
+	_commandBufferSlab* commandBufferSlabs;
+	_controlListSlab* controlListSlabs;
+	uint32_t nextCommandBufferSlabSize; //in command buffers
+	uint32_t nextControlListSlabSize; //in bytes
 	uint32_t queueFamilyIndex;
+	VkAllocationCallbacks allocator; //slabs are also allocated while recording, so keep a copy
+	uint32_t hasAllocator;
 } _commandPool;
 
 typedef enum commandBufferState
@@ -66,8 +180,7 @@ typedef enum commandBufferState
 	CMDBUF_STATE_INITIAL = 0,
 	CMDBUF_STATE_RECORDING,
 	CMDBUF_STATE_EXECUTABLE,
-	CMDBUF_STATE_PENDING,
-	CMDBUF_STATE_INVALID,
+	CMDBUF_STATE_INVALID, //pending is tracked separately, see numPendingSubmits
 	CMDBUF_STATE_LAST
 } commandBufferState;
 
@@ -92,8 +205,24 @@ typedef struct VkInstance_T
 	int hasEtc1;
 	int hasThreadedFs;
 	int hasMadvise;
+	int hasSyncobj;
 } _instance;
 
+//with RPI_VK_SUBALLOCATE=1 allocations up to DEVICE_MEMORY_MAX_SUBALLOCATION share slab BOs
+#define DEVICE_MEMORY_SLAB_SIZE (ARM_PAGE_SIZE * 1024)
+#define DEVICE_MEMORY_MAX_SUBALLOCATION (DEVICE_MEMORY_SLAB_SIZE >> 4)
+
+//BO that device memory allocations are carved out of, in pages
+typedef struct _memorySlab
+{
+	struct _memorySlab* next;
+	uint32_t bo;
+	void* mappedPtr; //whole slab, mapped on the first vkMapMemory of any of its allocations
+	uint32_t numAllocations;
+	uint32_t numMapped; //allocations currently mapped by the application
+	OffsetAllocator oa;
+} _memorySlab;
+
 typedef struct VkDevice_T
 {
 	int enabledExtensions[numDeviceExtensions];
@@ -102,6 +231,10 @@ typedef struct VkDevice_T
 	_physicalDevice* dev;
 	_queue* queues[numQueueFamilies];
 	int numQueues[numQueueFamilies];
+	uint32_t suballocate;
+	_memorySlab* memorySlabs;
+	struct VkDeviceMemory_T* cachedMappings; //allocations with their own BO that hold a CPU mapping
+	pthread_mutex_t memoryMutex; //guards the slabs and the cached mappings
 } _device;
 
 typedef struct VkRenderPass_T
@@ -131,9 +264,13 @@ typedef struct VkDeviceMemory_T
 {
 	uint32_t size;
 	uint32_t bo;
+	uint32_t offset; //of the allocation in bo, non-zero only for suballocations
+	_memorySlab* slab; //0 if the allocation has its own BO
 	uint32_t memTypeIndex;
-	void* mappedPtr;
+	void* mappedPtr; //returned by vkMapMemory, 0 while not mapped
 	uint32_t mappedOffset, mappedSize;
+	void* cpuMapping; //whole BO, kept across vkUnmapMemory until freed or trimmed
+	struct VkDeviceMemory_T* prevMapping, *nextMapping; //in _device::cachedMappings
 } _deviceMemory;
 
 typedef struct VkBuffer_T
@@ -160,8 +297,6 @@ typedef struct VkImage_T
 	uint32_t format;
 	uint32_t imageSpace;
 	uint32_t tiling; //T or LT
-	uint32_t needToClear;
-	uint32_t clearColor[2];
 	uint32_t layout;
 	_deviceMemory* boundMem;
 	uint32_t boundOffset;
@@ -201,6 +336,38 @@ typedef struct VkFramebuffer_T
 	uint32_t width, height, layers;
 } _framebuffer;
 
+//what a job does with its surfaces at the start and end of every tile
+typedef enum _tileBufferOps
+{
+	TILE_LOAD_COLOR = 1 << 0, //otherwise the tile starts out cleared
+	TILE_STORE_COLOR = 1 << 1, //otherwise the rendered tile is discarded
+	TILE_LOAD_ZS = 1 << 2,
+	TILE_STORE_ZS = 1 << 3
+} _tileBufferOps;
+
+typedef struct _renderTarget
+{
+	_image* color; //either can be 0, but not both
+	_image* depthStencil;
+	_image* resolve; //single sampled image multisampled color is resolved into when tiles are stored, or 0
+	uint32_t ops; //_tileBufferOps
+	uint32_t clearColor[2];
+	uint32_t clearDepth, clearStencil; //24 and 8 bit
+} _renderTarget;
+
+//vkCmdClearColorImage and vkCmdClearDepthStencilImage don't emit anything,
+//the clear is merged into the next job rendering to the image, or gets a job of its own
+//if the image might be read before that
+typedef struct _pendingClear
+{
+	_image* image;
+	uint32_t clearColor[2];
+	uint32_t clearDepth, clearStencil;
+} _pendingClear;
+
+//more pending clears than this are flushed into jobs
+#define CMDBUF_MAX_PENDING_CLEARS 4
+
 typedef struct VkShaderModule_T
 {
 	uint32_t bos[VK_RPI_ASSEMBLY_TYPE_MAX];
@@ -258,19 +425,70 @@ typedef struct VkPipeline_T
 	uint32_t subpass;
 } _pipeline;
 
+typedef enum commandBufferDirtyBits
+{
+	CMDBUF_DIRTY_VERTEX_BUFFER = 1 << 0,
+	CMDBUF_DIRTY_INDEX_BUFFER = 1 << 1,
+	CMDBUF_DIRTY_VIEWPORT = 1 << 2,
+	CMDBUF_DIRTY_LINE_WIDTH = 1 << 3,
+	CMDBUF_DIRTY_DEPTH_BIAS = 1 << 4,
+	CMDBUF_DIRTY_GRAPHICS_PIPELINE = 1 << 5,
+	CMDBUF_DIRTY_COMPUTE_PIPELINE = 1 << 6,
+	CMDBUF_DIRTY_SUBPASS = 1 << 7,
+	CMDBUF_DIRTY_BLEND_CONSTANTS = 1 << 8,
+	CMDBUF_DIRTY_SCISSOR = 1 << 9,
+	CMDBUF_DIRTY_DEPTH_BOUNDS = 1 << 10,
+	CMDBUF_DIRTY_STENCIL_COMPARE_MASK = 1 << 11,
+	CMDBUF_DIRTY_STENCIL_WRITE_MASK = 1 << 12,
+	CMDBUF_DIRTY_STENCIL_REFERENCE = 1 << 13,
+	CMDBUF_DIRTY_DESCRIPTOR_SET = 1 << 14,
+	CMDBUF_DIRTY_PUSH_CONSTANT = 1 << 15,
+	CMDBUF_DIRTY_ALL = (1 << 16) - 1
+} commandBufferDirtyBits;
+
+//binning state packets that vkCmdDraw only emits when their contents change
+typedef enum statePacket
+{
+	STATE_PACKET_CLIP_WINDOW = 0,
+	STATE_PACKET_CONFIGURATION_BITS,
+	STATE_PACKET_DEPTH_OFFSET,
+	STATE_PACKET_POINT_SIZE,
+	STATE_PACKET_LINE_WIDTH,
+	STATE_PACKET_CLIPPER_XY_SCALING,
+	STATE_PACKET_CLIPPER_Z_SCALE_AND_OFFSET,
+	STATE_PACKET_VIEWPORT_OFFSET,
+	STATE_PACKET_FLAT_SHADE_FLAGS,
+	STATE_PACKET_COUNT
+} statePacket;
+
+//largest of the state packets above
+#define STATE_PACKET_MAX_SIZE 12
+
+//copy of the last emitted state packets in the binning CL
+typedef struct commandBufferStateShadow
+{
+	uint32_t validMask; //bit per statePacket, cleared whenever the binner state is reset
+	uint8_t packets[STATE_PACKET_COUNT][STATE_PACKET_MAX_SIZE];
+} commandBufferStateShadow;
+
 typedef struct VkCommandBuffer_T
 {
 	//Recorded commands include commands to bind pipelines and descriptor sets to the command buffer, commands to modify dynamic state, commands to draw (for graphics rendering),
 	//commands to dispatch (for compute), commands to execute secondary command buffers (for primary command buffers only), commands to copy buffers and images, and other commands
 
-	struct drm_vc4_submit_cl submitCl;
+	struct drm_vc4_submit_cl submitCl; //job of the render pass being recorded
+	ControlList jobsCl; //drm_vc4_submit_cl of each recorded render pass, CL pointers in them are offsets until vkEndCommandBuffer resolves them
+	uint32_t numJobs;
 
-	ControlList binCl;
+	ControlList binCl; //chunked while recording, flattened by vkEndCommandBuffer
 	ControlList shaderRecCl;
 	uint32_t shaderRecCount;
 	ControlList uniformsCl;
 	ControlList handlesCl;
-	commandBufferState state;
+	ControlListHandleHash handlesHash; //BO handle -> index in handlesCl
+	commandBufferState state; //while pending, the state the command buffer returns to afterwards
+	atomic_uint numPendingSubmits; //submissions whose last job hasn't reached the kernel yet, pending while not 0
+	VkResult recordResult; //first error hit while recording, returned by vkEndCommandBuffer
 	VkCommandBufferUsageFlags usageFlags;
 	_commandPool* cp;
 
@@ -281,24 +499,12 @@ typedef struct VkCommandBuffer_T
 	_pipeline* graphicsPipeline;
 	_pipeline* computePipeline;
 
-	uint32_t firstDraw; //so we can set tile binning config etc.
-
-	uint32_t vertexBufferDirty;
-	uint32_t indexBufferDirty;
-	uint32_t viewportDirty;
-	uint32_t lineWidthDirty;
-	uint32_t depthBiasDirty;
-	uint32_t graphicsPipelineDirty;
-	uint32_t computePipelineDirty;
-	uint32_t subpassDirty;
-	uint32_t blendConstantsDirty;
-	uint32_t scissorDirty;
-	uint32_t depthBoundsDirty;
-	uint32_t stencilCompareMaskDirty;
-	uint32_t stencilWriteMaskDirty;
-	uint32_t stencilReferenceDirty;
-	uint32_t descriptorSetDirty;
-	uint32_t pushConstantDirty;
+	uint32_t dirty; //commandBufferDirtyBits changed since the last draw
+	commandBufferStateShadow shadow;
+	uint32_t stateBytesSaved; //size of the state packets that were not emitted, as they were already set
+
+	_pendingClear pendingClears[CMDBUF_MAX_PENDING_CLEARS];
+	uint32_t numPendingClears;
 
 	VkViewport viewport;
 	VkRect2D scissor;
@@ -319,7 +525,9 @@ typedef struct VkCommandBuffer_T
 
 typedef struct VkFence_T
 {
-	uint64_t seqno;
+	_queue* queue; //set while the fence is pending
+	uint64_t jobIndex; //seqno is valid once the queue's submit thread processed this many jobs
+	uint64_t seqno; //of the last job submitted before the fence
 	uint32_t signaled;
 } _fence;
 
@@ -338,10 +546,34 @@ int findInstanceExtension(char* name);
 int findDeviceExtension(char* name);
 void getPaddedTextureDimensionsT(uint32_t width, uint32_t height, uint32_t bpp, uint32_t* paddedWidth, uint32_t* paddedHeight);
 int isDepthStencilFormat(VkFormat format);
+VkImageAspectFlags getDepthStencilAspects(VkFormat format);
 uint32_t getDepthCompareOp(VkCompareOp op);
 uint32_t getTopology(VkPrimitiveTopology topology);
 uint32_t getPrimitiveMode(VkPrimitiveTopology topology);
 uint32_t getFormatByteSize(VkFormat format);
 uint32_t ulog2(uint32_t v);
+void queueInitThrottle(_queue* q, const VkDeviceCreateInfo* pCreateInfo, const VkDeviceQueueCreateInfo* pQueueCreateInfo);
+uint32_t queueStartSubmitThread(_queue* q, void* jobMem);
+void queueStopSubmitThread(_queue* q);
+void queueWaitForSubmitThread(_queue* q);
+uint32_t queueWaitForJobs(_queue* q, uint64_t numJobs, uint64_t deadline);
+uint32_t queueJobsDone(_queue* q, uint64_t numJobs);
+void semaphoreWait(_semaphore* s);
+void semaphoreSignal(_semaphore* s);
+void timelineWaitSubmitted(_semaphore* s, uint64_t value);
+void timelineSignalSeqno(_semaphore* s, uint64_t value, uint64_t seqno);
+void* commandPoolAllocate(_commandPool* cp, uint32_t numBlocks);
+void commandPoolFree(_commandPool* cp, void* p, uint32_t numBlocks);
+void* commandPoolReAllocate(_commandPool* cp, void* currentMem, uint32_t currNumBlocks);
 void clFit(VkCommandBuffer cb, ControlList* cl, uint32_t commandSize);
+uint32_t clFlatten(VkCommandBuffer cb, ControlList* cl);
+uint32_t clTotalSize(ControlList* cl);
+void deviceFreeMemorySlabs(_device* dev);
+uint32_t memoryCommit(_deviceMemory* mem);
+void clReset(VkCommandBuffer cb, ControlList* cl);
 void clDump(void* cl, uint32_t size);
+void binningBegin(VkCommandBuffer commandBuffer, const _renderTarget* rt, const VkRect2D* renderArea);
+void binningEnd(VkCommandBuffer commandBuffer);
+void commandBufferAddClear(VkCommandBuffer commandBuffer, const _pendingClear* clear);
+void commandBufferFlushClears(VkCommandBuffer commandBuffer);
+uint32_t commandBufferIsPending(VkCommandBuffer commandBuffer);
@@ -175,6 +175,15 @@ VKAPI_ATTR VkResult VKAPI_CALL vkGetPhysicalDeviceSurfaceSupportKHR(
 	return VK_SUCCESS;
 }
 
+//undoes a vkCreateDevice that failed after the queues were set up to be created:
+//stops the submit threads already started and frees their job memory, the queues and the device
+static VkResult deviceCreateFailed(VkDevice* pDevice, const VkAllocationCallbacks* pAllocator, VkResult result)
+{
+	vkDestroyDevice(*pDevice, pAllocator);
+	*pDevice = 0;
+	return result;
+}
+
 /*
  * https://www.khronos.org/registry/vulkan/specs/1.1-extensions/html/vkspec.html#vkCreateDevice
  * vkCreateDevice verifies that extensions and features requested in the ppEnabledExtensionNames and pEnabledFeatures
@@ -264,8 +273,15 @@ VKAPI_ATTR VkResult VKAPI_CALL vkCreateDevice(
 	for(int c = 0; c < numQueueFamilies; ++c)
 	{
 		(*pDevice)->queues[c] = 0;
+		(*pDevice)->numQueues[c] = 0;
 	}
 
+	const char* suballocate = getenv("RPI_VK_SUBALLOCATE");
+	(*pDevice)->suballocate = suballocate && atoi(suballocate);
+	(*pDevice)->memorySlabs = 0;
+	(*pDevice)->cachedMappings = 0;
+	pthread_mutex_init(&(*pDevice)->memoryMutex, 0);
+
 	if(pCreateInfo->queueCreateInfoCount > 0)
 	{
 		for(int c = 0; c < pCreateInfo->queueCreateInfoCount; ++c)
@@ -274,15 +290,31 @@ VKAPI_ATTR VkResult VKAPI_CALL vkCreateDevice(
 
 			if(!(*pDevice)->queues[pCreateInfo->pQueueCreateInfos[c].queueFamilyIndex])
 			{
-				return VK_ERROR_OUT_OF_HOST_MEMORY;
+				return deviceCreateFailed(pDevice, pAllocator, VK_ERROR_OUT_OF_HOST_MEMORY);
 			}
 
 			for(int d = 0; d < pCreateInfo->pQueueCreateInfos[c].queueCount; ++d)
 			{
-				(*pDevice)->queues[pCreateInfo->pQueueCreateInfos[c].queueFamilyIndex][d].lastEmitSeqno = 0;
+				_queue* q = &(*pDevice)->queues[pCreateInfo->pQueueCreateInfos[c].queueFamilyIndex][d];
+				q->lastEmitSeqno = 0;
+				q->dev = *pDevice;
+				queueInitThrottle(q, pCreateInfo, &pCreateInfo->pQueueCreateInfos[c]);
+
+				void* jobMem = ALLOCATE(sizeof(_submitJob) * QUEUE_MAX_SUBMIT_JOBS, 1, VK_SYSTEM_ALLOCATION_SCOPE_OBJECT);
+				if(!jobMem)
+				{
+					return deviceCreateFailed(pDevice, pAllocator, VK_ERROR_OUT_OF_HOST_MEMORY);
+				}
+
+				if(!queueStartSubmitThread(q, jobMem))
+				{
+					FREE(jobMem);
+					return deviceCreateFailed(pDevice, pAllocator, VK_ERROR_INITIALIZATION_FAILED);
+				}
+
+				//counted as soon as the submit thread runs, so a failure later on stops it
+				(*pDevice)->numQueues[pCreateInfo->pQueueCreateInfos[c].queueFamilyIndex] = d + 1;
 			}
-
-			(*pDevice)->numQueues[pCreateInfo->pQueueCreateInfos[c].queueFamilyIndex] = pCreateInfo->pQueueCreateInfos[c].queueCount;
 		}
 	}
 
@@ -327,10 +359,20 @@ VKAPI_ATTR void VKAPI_CALL vkDestroyDevice(
 	{
 		for(int d = 0; d < dev->numQueues[c]; ++d)
 		{
-			FREE(dev->queues[d]);
+			char* jobMem = dev->queues[c][d].jobs.buf;
+			queueStopSubmitThread(&dev->queues[c][d]);
+			FREE(jobMem);
+		}
+
+		if(dev->queues[c])
+		{
+			FREE(dev->queues[c]);
 		}
 	}
 
+	deviceFreeMemorySlabs(dev);
+	pthread_mutex_destroy(&dev->memoryMutex);
+
 	FREE(dev);
 }
 
@@ -2,6 +2,41 @@
 
 #include "kernel/vc4_packet.h"
 
+//a packet only has to be looked at if it was never emitted or if state it is built from changed
+//otherwise the binner already has it
+static uint32_t statePacketNeedsUpdate(_commandBuffer* cb, statePacket packet, uint32_t dirtyBits, uint32_t size)
+{
+	if((cb->shadow.validMask & (1 << packet)) && !(cb->dirty & dirtyBits))
+	{
+		cb->stateBytesSaved += size;
+		return 0;
+	}
+
+	return 1;
+}
+
+//the packet is built in a scratch CL and only copied to the binning CL if it differs from the last one emitted
+//eg. rebinding the same pipeline marks the state dirty, but doesn't change it
+static void emitStatePacket(_commandBuffer* cb, statePacket packet, ControlList* scratch)
+{
+	uint32_t size = clSize(scratch);
+	assert(size <= STATE_PACKET_MAX_SIZE);
+
+	uint8_t* shadow = cb->shadow.packets[packet];
+	if((cb->shadow.validMask & (1 << packet)) && !memcmp(shadow, scratch->buffer, size))
+	{
+		cb->stateBytesSaved += size;
+		return;
+	}
+
+	memcpy(shadow, scratch->buffer, size);
+	cb->shadow.validMask |= 1 << packet;
+
+	clFit(cb, &cb->binCl, size);
+	memcpy(cb->binCl.nextFreeByte, scratch->buffer, size);
+	cb->binCl.nextFreeByte += size;
+}
+
 /*
  * https://www.khronos.org/registry/vulkan/specs/1.1-extensions/html/vkspec.html#vkCmdDraw
  */
@@ -16,80 +51,106 @@ void vkCmdDraw(VkCommandBuffer commandBuffer, uint32_t vertexCount, uint32_t ins
 	//TODO handle multiple attachments etc.
 	_image* i = fb->attachmentViews[rp->subpasses[cb->currentSubpass].pColorAttachments[0].attachment].image;
 
+	//the binning prologue and epilogue are emitted by vkCmdBeginRenderPass and vkCmdEndRenderPass
 
-	//stuff needed to submit a draw call:
-	//Tile Binning Mode Configuration
-	clFit(commandBuffer, &commandBuffer->binCl, V3D21_TILE_BINNING_MODE_CONFIGURATION_length);
-	clInsertTileBinningModeConfiguration(&commandBuffer->binCl,
-										 0, 0, 0, 0,
-										 getFormatBpp(i->format) == 64, //64 bit color mode
-										 i->samples > 1, //msaa
-										 i->width, i->height, 0, 0, 0);
-
-	//Start Tile Binning
-	clFit(commandBuffer, &commandBuffer->binCl, V3D21_START_TILE_BINNING_length);
-	clInsertStartTileBinning(&commandBuffer->binCl);
-
-	//Primitive List Format
-	clFit(commandBuffer, &commandBuffer->binCl, V3D21_PRIMITIVE_LIST_FORMAT_length);
-	clInsertPrimitiveListFormat(&commandBuffer->binCl,
-								1, //16 bit
-								getTopology(cb->graphicsPipeline->topology)); //tris
+	//state packets, only emitted when they differ from what the binner already has
+	uint8_t scratchBuf[STATE_PACKET_MAX_SIZE];
+	ControlList scratch;
 
 	//Clip Window
-	clFit(commandBuffer, &commandBuffer->binCl, V3D21_CLIP_WINDOW_length);
-	clInsertClipWindow(&commandBuffer->binCl, i->width, i->height, 0, 0);
+	if(statePacketNeedsUpdate(cb, STATE_PACKET_CLIP_WINDOW, CMDBUF_DIRTY_SUBPASS | CMDBUF_DIRTY_SCISSOR, V3D21_CLIP_WINDOW_length))
+	{
+		clInit(&scratch, scratchBuf);
+		//nothing outside the render area is stored, so don't bin primitives there
+		clInsertClipWindow(&scratch, cb->renderArea.extent.width, cb->renderArea.extent.height, cb->renderArea.offset.y, cb->renderArea.offset.x);
+		emitStatePacket(cb, STATE_PACKET_CLIP_WINDOW, &scratch);
+	}
 
 	//Configuration Bits
-	clFit(commandBuffer, &commandBuffer->binCl, V3D21_CONFIGURATION_BITS_length);
-	clInsertConfigurationBits(&commandBuffer->binCl,
-							  1, //TODO earlyz updates
-							  0, //TODO earlyz enable
-							  0, //TODO z updates
-							  cb->graphicsPipeline->depthTestEnable ? getDepthCompareOp(cb->graphicsPipeline->depthCompareOp) : V3D_COMPARE_FUNC_ALWAYS, //depth compare func
-							  0,
-							  0,
-							  0,
-							  0,
-							  0,
-							  cb->graphicsPipeline->depthBiasEnable, //depth offset enable
-							  cb->graphicsPipeline->frontFace == VK_FRONT_FACE_CLOCKWISE, //clockwise
-							  !(cb->graphicsPipeline->cullMode & VK_CULL_MODE_BACK_BIT), //enable back facing primitives
-							  !(cb->graphicsPipeline->cullMode & VK_CULL_MODE_FRONT_BIT)); //enable front facing primitives
+	if(statePacketNeedsUpdate(cb, STATE_PACKET_CONFIGURATION_BITS, CMDBUF_DIRTY_GRAPHICS_PIPELINE, V3D21_CONFIGURATION_BITS_length))
+	{
+		clInit(&scratch, scratchBuf);
+		clInsertConfigurationBits(&scratch,
+								  1, //TODO earlyz updates
+								  0, //TODO earlyz enable
+								  0, //TODO z updates
+								  cb->graphicsPipeline->depthTestEnable ? getDepthCompareOp(cb->graphicsPipeline->depthCompareOp) : V3D_COMPARE_FUNC_ALWAYS, //depth compare func
+								  0,
+								  0,
+								  0,
+								  0,
+								  0,
+								  cb->graphicsPipeline->depthBiasEnable, //depth offset enable
+								  cb->graphicsPipeline->frontFace == VK_FRONT_FACE_CLOCKWISE, //clockwise
+								  !(cb->graphicsPipeline->cullMode & VK_CULL_MODE_BACK_BIT), //enable back facing primitives
+								  !(cb->graphicsPipeline->cullMode & VK_CULL_MODE_FRONT_BIT)); //enable front facing primitives
+		emitStatePacket(cb, STATE_PACKET_CONFIGURATION_BITS, &scratch);
+	}
 
 	//TODO Depth Offset
-	clFit(commandBuffer, &commandBuffer->binCl, V3D21_DEPTH_OFFSET_length);
-	clInsertDepthOffset(&commandBuffer->binCl, cb->graphicsPipeline->depthBiasConstantFactor, cb->graphicsPipeline->depthBiasSlopeFactor);
+	if(statePacketNeedsUpdate(cb, STATE_PACKET_DEPTH_OFFSET, CMDBUF_DIRTY_GRAPHICS_PIPELINE | CMDBUF_DIRTY_DEPTH_BIAS, V3D21_DEPTH_OFFSET_length))
+	{
+		clInit(&scratch, scratchBuf);
+		clInsertDepthOffset(&scratch, cb->graphicsPipeline->depthBiasConstantFactor, cb->graphicsPipeline->depthBiasSlopeFactor);
+		emitStatePacket(cb, STATE_PACKET_DEPTH_OFFSET, &scratch);
+	}
 
 	//Point size
-	clFit(commandBuffer, &commandBuffer->binCl, V3D21_POINT_SIZE_length);
-	clInsertPointSize(&commandBuffer->binCl, 1.0f);
+	if(statePacketNeedsUpdate(cb, STATE_PACKET_POINT_SIZE, 0, V3D21_POINT_SIZE_length))
+	{
+		clInit(&scratch, scratchBuf);
+		clInsertPointSize(&scratch, 1.0f);
+		emitStatePacket(cb, STATE_PACKET_POINT_SIZE, &scratch);
+	}
 
 	//Line width
-	clFit(commandBuffer, &commandBuffer->binCl, V3D21_LINE_WIDTH_length);
-	clInsertLineWidth(&commandBuffer->binCl, cb->graphicsPipeline->lineWidth);
+	if(statePacketNeedsUpdate(cb, STATE_PACKET_LINE_WIDTH, CMDBUF_DIRTY_GRAPHICS_PIPELINE | CMDBUF_DIRTY_LINE_WIDTH, V3D21_LINE_WIDTH_length))
+	{
+		clInit(&scratch, scratchBuf);
+		clInsertLineWidth(&scratch, cb->graphicsPipeline->lineWidth);
+		emitStatePacket(cb, STATE_PACKET_LINE_WIDTH, &scratch);
+	}
 
 	//TODO why flipped???
 	//Clipper XY Scaling
-	clFit(commandBuffer, &commandBuffer->binCl, V3D21_CLIPPER_XY_SCALING_length);
-	clInsertClipperXYScaling(&commandBuffer->binCl, (float)(i->width) * 0.5f * 16.0f, -1.0f * (float)(i->height) * 0.5f * 16.0f);
+	if(statePacketNeedsUpdate(cb, STATE_PACKET_CLIPPER_XY_SCALING, CMDBUF_DIRTY_SUBPASS | CMDBUF_DIRTY_VIEWPORT, V3D21_CLIPPER_XY_SCALING_length))
+	{
+		clInit(&scratch, scratchBuf);
+		clInsertClipperXYScaling(&scratch, (float)(i->width) * 0.5f * 16.0f, -1.0f * (float)(i->height) * 0.5f * 16.0f);
+		emitStatePacket(cb, STATE_PACKET_CLIPPER_XY_SCALING, &scratch);
+	}
 
 	//TODO how is this calculated?
 	//seems to go from -1.0 .. 1.0 to 0.0 .. 1.0
 	//eg. x * 0.5 + 0.5
 	//cb->graphicsPipeline->minDepthBounds;
 	//Clipper Z Scale and Offset
-	clFit(commandBuffer, &commandBuffer->binCl, V3D21_CLIPPER_Z_SCALE_AND_OFFSET_length);
-	clInsertClipperZScaleOffset(&commandBuffer->binCl, 0.5f, 0.5f);
+	if(statePacketNeedsUpdate(cb, STATE_PACKET_CLIPPER_Z_SCALE_AND_OFFSET, CMDBUF_DIRTY_VIEWPORT, V3D21_CLIPPER_Z_SCALE_AND_OFFSET_length))
+	{
+		clInit(&scratch, scratchBuf);
+		clInsertClipperZScaleOffset(&scratch, 0.5f, 0.5f);
+		emitStatePacket(cb, STATE_PACKET_CLIPPER_Z_SCALE_AND_OFFSET, &scratch);
+	}
 
 	//Viewport Offset
-	clFit(commandBuffer, &commandBuffer->binCl, V3D21_VIEWPORT_OFFSET_length);
-	clInsertViewPortOffset(&commandBuffer->binCl, i->width >> 1, i->height >> 1);
+	if(statePacketNeedsUpdate(cb, STATE_PACKET_VIEWPORT_OFFSET, CMDBUF_DIRTY_SUBPASS | CMDBUF_DIRTY_VIEWPORT, V3D21_VIEWPORT_OFFSET_length))
+	{
+		clInit(&scratch, scratchBuf);
+		clInsertViewPortOffset(&scratch, i->width >> 1, i->height >> 1);
+		emitStatePacket(cb, STATE_PACKET_VIEWPORT_OFFSET, &scratch);
+	}
 
 	//TODO?
 	//Flat Shade Flags
-	clFit(commandBuffer, &commandBuffer->binCl, V3D21_FLAT_SHADE_FLAGS_length);
-	clInsertFlatShadeFlags(&commandBuffer->binCl, 0);
+	if(statePacketNeedsUpdate(cb, STATE_PACKET_FLAT_SHADE_FLAGS, CMDBUF_DIRTY_GRAPHICS_PIPELINE, V3D21_FLAT_SHADE_FLAGS_length))
+	{
+		clInit(&scratch, scratchBuf);
+		clInsertFlatShadeFlags(&scratch, 0);
+		emitStatePacket(cb, STATE_PACKET_FLAT_SHADE_FLAGS, &scratch);
+	}
+
+	//everything the draw depends on is in the CL now
+	cb->dirty &= CMDBUF_DIRTY_COMPUTE_PIPELINE;
 
 	//TODO how to get address?
 	//GL Shader State
@@ -130,6 +191,7 @@ void vkCmdDraw(VkCommandBuffer commandBuffer, uint32_t vertexCount, uint32_t ins
 	clInsertShaderRecord(&commandBuffer->shaderRecCl,
 						 &relocCl,
 						 &commandBuffer->handlesCl,
+						 &commandBuffer->handlesHash,
 						 1, //TODO single threaded?
 						 0, //point size included in shaded vertex data?
 						 1, //enable clipping?
@@ -149,15 +211,18 @@ void vkCmdDraw(VkCommandBuffer commandBuffer, uint32_t vertexCount, uint32_t ins
 						 coordCode  //coordinate shader code address
 						 );
 
+	uint32_t binding = cb->graphicsPipeline->vertexAttributeDescriptions[0].location;
+	_buffer* vb = cb->vertexBuffers[binding];
 	ControlListAddress vertexBuffer = {
-		.handle = cb->vertexBuffers[cb->graphicsPipeline->vertexAttributeDescriptions[0].location]->boundMem->bo,
-		.offset = 0,
+		.handle = vb->boundMem->bo,
+		.offset = vb->boundMem->offset + vb->boundOffset + cb->vertexBufferOffsets[binding],
 	};
 
 	clFit(commandBuffer, &commandBuffer->shaderRecCl, V3D21_ATTRIBUTE_RECORD_length);
 	clInsertAttributeRecord(&commandBuffer->shaderRecCl,
 							&relocCl,
 							&commandBuffer->handlesCl,
+							&commandBuffer->handlesHash,
 							vertexBuffer, //address
 							getFormatByteSize(cb->graphicsPipeline->vertexAttributeDescriptions[0].format),
 							cb->graphicsPipeline->vertexBindingDescriptions[0].stride, //stride
@@ -177,49 +242,7 @@ void vkCmdDraw(VkCommandBuffer commandBuffer, uint32_t vertexCount, uint32_t ins
 	//clFit(commandBuffer, &commandBuffer->handlesCl, 4);
 	//uint32_t fragIdx = clGetHandleIndex(&commandBuffer->handlesCl, fragCode.handle);
 
-	//Insert image handle index
-	clFit(commandBuffer, &commandBuffer->handlesCl, 4);
-	uint32_t imageIdx = clGetHandleIndex(&commandBuffer->handlesCl, i->boundMem->bo);
-
-	//fill out submit cl fields
-	commandBuffer->submitCl.color_write.hindex = imageIdx;
-	commandBuffer->submitCl.color_write.offset = 0;
-	commandBuffer->submitCl.color_write.flags = 0;
-	//TODO format
-	commandBuffer->submitCl.color_write.bits =
-			VC4_SET_FIELD(VC4_RENDER_CONFIG_FORMAT_RGBA8888, VC4_RENDER_CONFIG_FORMAT) |
-			VC4_SET_FIELD(i->tiling, VC4_RENDER_CONFIG_MEMORY_FORMAT);
-
-	commandBuffer->submitCl.clear_color[0] = i->clearColor[0];
-	commandBuffer->submitCl.clear_color[1] = i->clearColor[1];
-
-	commandBuffer->submitCl.min_x_tile = 0;
-	commandBuffer->submitCl.min_y_tile = 0;
-
-	uint32_t tileSizeW = 64;
-	uint32_t tileSizeH = 64;
-
-	if(i->samples > 1)
-	{
-		tileSizeW >>= 1;
-		tileSizeH >>= 1;
-	}
-
-	if(getFormatBpp(i->format) == 64)
-	{
-		tileSizeH >>= 1;
-	}
-
-	uint32_t widthInTiles = divRoundUp(i->width, tileSizeW);
-	uint32_t heightInTiles = divRoundUp(i->height, tileSizeH);
-
-	commandBuffer->submitCl.max_x_tile = widthInTiles - 1;
-	commandBuffer->submitCl.max_y_tile = heightInTiles - 1;
-	commandBuffer->submitCl.width = i->width;
-	commandBuffer->submitCl.height = i->height;
-	commandBuffer->submitCl.flags |= VC4_SUBMIT_CL_USE_CLEAR_COLOR;
-	commandBuffer->submitCl.clear_z = 0; //TODO
-	commandBuffer->submitCl.clear_s = 0;
+	//the render target and tile bounds of the job were set up by vkCmdBeginRenderPass
 
 	//write uniforms
 	//TODO
@@ -105,6 +105,8 @@ VKAPI_ATTR VkResult VKAPI_CALL vkCreateInstance(
 
 	int ret = openIoctl(); assert(ret != -1);
 
+	traceInit();
+
 	(*pInstance)->chipVersion = vc4_get_chip_info(controlFd);
 	(*pInstance)->hasTiling = vc4_test_tiling(controlFd);
 
@@ -112,6 +114,9 @@ VKAPI_ATTR VkResult VKAPI_CALL vkCreateInstance(
 	(*pInstance)->hasEtc1 = vc4_has_feature(controlFd, DRM_VC4_PARAM_SUPPORTS_ETC1);
 	(*pInstance)->hasThreadedFs = vc4_has_feature(controlFd, DRM_VC4_PARAM_SUPPORTS_THREADED_FS);
 	(*pInstance)->hasMadvise = vc4_has_feature(controlFd, DRM_VC4_PARAM_SUPPORTS_MADVISE);
+	(*pInstance)->hasSyncobj = vc4_has_capability(controlFd, DRM_CAP_SYNCOBJ);
+
+	vc4_bo_cache_init((*pInstance)->hasMadvise);
 
 	return VK_SUCCESS;
 }
@@ -126,6 +131,8 @@ VKAPI_ATTR void VKAPI_CALL vkDestroyInstance(
 {
 	assert(instance);
 
+	vc4_bo_cache_free_all(controlFd);
+
 	closeIoctl();
 
 	FREE(instance);
@@ -329,6 +336,9 @@ VKAPI_ATTR PFN_vkVoidFunction VKAPI_CALL vkGetInstanceProcAddr(
 	RETFUNC(vkUpdateDescriptorSetWithTemplate);
 	RETFUNC(vkGetDescriptorSetLayoutSupport);
 	RETFUNC(vkBindBufferMemory2);
+	RETFUNC(vkGetSemaphoreCounterValueKHR);
+	RETFUNC(vkWaitSemaphoresKHR);
+	RETFUNC(vkSignalSemaphoreKHR);
 
 
 	return 0;
@@ -1,6 +1,9 @@
 #define _GNU_SOURCE
 #include "kernelInterface.h"
+#include "Tracer.h"
 #include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
 
 atomic_int refCounter = 0;
 int controlFd = 0;
@@ -116,6 +119,22 @@ int vc4_has_feature(int fd, uint32_t feature)
 	return p.value;
 }
 
+int vc4_has_capability(int fd, uint64_t capability)
+{
+	assert(fd);
+
+	struct drm_get_cap c = {
+		.capability = capability,
+	};
+
+	if (drmIoctl(fd, DRM_IOCTL_GET_CAP, &c))
+	{
+		return 0;
+	}
+
+	return c.value;
+}
+
 int vc4_test_tiling(int fd)
 {
 	assert(fd);
@@ -222,6 +241,83 @@ void vc4_bo_unmap_unsynchronized(int fd, void* ptr, uint32_t size)
 	munmap(ptr, size);
 }
 
+//seqno of the last job that referenced each BO we allocated, indexed by GEM handle
+//imported BOs may be used by others, so they are untracked and waited on through the kernel
+#define BO_BUSY_UNTRACKED 0xffffffffffffffffull
+static struct
+{
+	pthread_mutex_t mutex;
+	uint64_t* seqnos;
+	uint32_t size;
+	uint64_t lastFinishedSeqno; //highest seqno any waiter saw finishing, jobs finish in order
+} boBusy = { .mutex = PTHREAD_MUTEX_INITIALIZER };
+
+//must be called with boBusy.mutex held
+static void boBusySet(uint32_t bo, uint64_t seqno)
+{
+	if(bo >= boBusy.size)
+	{
+		if(seqno == BO_BUSY_UNTRACKED)
+		{
+			return;
+		}
+
+		uint32_t size = boBusy.size ? boBusy.size * 2 : 256;
+		while(size <= bo)
+		{
+			size *= 2;
+		}
+		uint64_t* seqnos = realloc(boBusy.seqnos, size * sizeof(uint64_t));
+		if(!seqnos)
+		{
+			return; //stays untracked
+		}
+
+		for(uint32_t c = boBusy.size; c < size; ++c)
+		{
+			seqnos[c] = BO_BUSY_UNTRACKED;
+		}
+
+		boBusy.seqnos = seqnos;
+		boBusy.size = size;
+	}
+
+	boBusy.seqnos[bo] = seqno;
+}
+
+static void boBusyTrack(uint32_t bo, uint64_t seqno)
+{
+	pthread_mutex_lock(&boBusy.mutex);
+	boBusySet(bo, seqno);
+	pthread_mutex_unlock(&boBusy.mutex);
+}
+
+static void boBusyFinished(uint64_t seqno)
+{
+	pthread_mutex_lock(&boBusy.mutex);
+	if(seqno > boBusy.lastFinishedSeqno)
+	{
+		boBusy.lastFinishedSeqno = seqno;
+	}
+	pthread_mutex_unlock(&boBusy.mutex);
+}
+
+//stamp every BO of a submitted job with its seqno
+static void boBusyMark(const struct drm_vc4_submit_cl* submit)
+{
+	const uint32_t* handles = (const uint32_t*)(uintptr_t)submit->bo_handles;
+
+	pthread_mutex_lock(&boBusy.mutex);
+	for(uint32_t c = 0; c < submit->bo_handle_count; ++c)
+	{
+		if(handles[c] < boBusy.size && boBusy.seqnos[handles[c]] != BO_BUSY_UNTRACKED)
+		{
+			boBusy.seqnos[handles[c]] = submit->seqno;
+		}
+	}
+	pthread_mutex_unlock(&boBusy.mutex);
+}
+
 int vc4_bo_wait(int fd, uint32_t bo, uint64_t timeout_ns)
 {
 	assert(fd);
@@ -232,11 +328,11 @@ int vc4_bo_wait(int fd, uint32_t bo, uint64_t timeout_ns)
 				.timeout_ns = timeout_ns,
 	};
 
-	printf("Wait for BO: %u\n", bo);
+	traceBoWait(bo);
 
 	int ret = drmIoctl(fd, DRM_IOCTL_VC4_WAIT_BO, &wait);
 	if (ret) {
-		if (ret != -ETIME) {
+		if (errno != ETIME) {
 			printf("BO wait failed: %s\n",
 				   strerror(errno));
 		}
@@ -259,16 +355,26 @@ int vc4_seqno_wait(int fd, uint64_t* lastFinishedSeqno, uint64_t seqno, uint64_t
 	if (*lastFinishedSeqno >= seqno)
 		return 1;
 
+	pthread_mutex_lock(&boBusy.mutex);
+	uint64_t finished = boBusy.lastFinishedSeqno;
+	pthread_mutex_unlock(&boBusy.mutex);
+
+	if (finished >= seqno)
+	{
+		*lastFinishedSeqno = finished;
+		return 1;
+	}
+
 	struct drm_vc4_wait_seqno wait = {
 		.seqno = seqno,
 				.timeout_ns = *timeout_ns,
 	};
 
-	printf("Wait for seqno: %llu\n", seqno);
+	traceSeqnoWait(seqno);
 
 	int ret = drmIoctl(fd, DRM_IOCTL_VC4_WAIT_SEQNO, &wait);
 	if (ret) {
-		if (ret != -ETIME) {
+		if (errno != ETIME) {
 			printf("Seqno wait failed: %s\n",
 				   strerror(errno));
 		}
@@ -284,9 +390,47 @@ int vc4_seqno_wait(int fd, uint64_t* lastFinishedSeqno, uint64_t seqno, uint64_t
 
 	*timeout_ns = wait.timeout_ns;
 	*lastFinishedSeqno = seqno;
+	boBusyFinished(seqno);
 	return 1;
 }
 
+//highest seqno known to have finished, answered without a syscall
+uint64_t vc4_last_finished_seqno()
+{
+	pthread_mutex_lock(&boBusy.mutex);
+	uint64_t finished = boBusy.lastFinishedSeqno;
+	pthread_mutex_unlock(&boBusy.mutex);
+
+	return finished;
+}
+
+//waits until every job submitted so far that references bo is done
+//returns 1 without an ioctl if the BO is known to be idle, 0 on timeout or error
+int vc4_bo_wait_busy(int fd, uint32_t bo, uint64_t timeout_ns)
+{
+	assert(fd);
+	assert(bo);
+
+	pthread_mutex_lock(&boBusy.mutex);
+	uint64_t seqno = bo < boBusy.size ? boBusy.seqnos[bo] : BO_BUSY_UNTRACKED;
+	uint64_t finished = boBusy.lastFinishedSeqno;
+	pthread_mutex_unlock(&boBusy.mutex);
+
+	if(seqno == BO_BUSY_UNTRACKED)
+	{
+		return vc4_bo_wait(fd, bo, timeout_ns);
+	}
+
+	if(seqno <= finished)
+	{
+		return 1;
+	}
+
+	traceBoWait(bo);
+
+	return vc4_seqno_wait(fd, &finished, seqno, &timeout_ns) > 0;
+}
+
 int vc4_bo_flink(int fd, uint32_t bo, uint32_t *name)
 {
 	assert(fd);
@@ -341,6 +485,8 @@ uint32_t vc4_bo_alloc_shader(int fd, const void *data, uint32_t* size)
 
 	*size = alignedSize;
 
+	boBusyTrack(create.handle, 0);
+
 	return create.handle;
 }
 
@@ -362,6 +508,254 @@ uint32_t vc4_bo_open_name(int fd, uint32_t name)
 	return o.handle;
 }
 
+//freed BOs are kept for reuse instead of going back to the kernel
+//each size in pages up to BO_CACHE_NUM_BUCKETS has a bucket, larger BOs share the last one
+typedef struct vc4_bo_cache_entry
+{
+	struct vc4_bo_cache_entry* prev; //bucket list, oldest first
+	struct vc4_bo_cache_entry* next;
+	struct vc4_bo_cache_entry* older; //time list across all buckets
+	struct vc4_bo_cache_entry* newer;
+	uint32_t bo;
+	uint32_t size;
+	uint64_t freeTime; //in ms
+} vc4_bo_cache_entry;
+
+typedef struct vc4_bo_cache_bucket
+{
+	vc4_bo_cache_entry* first;
+	vc4_bo_cache_entry* last;
+} vc4_bo_cache_bucket;
+
+static struct
+{
+	pthread_mutex_t mutex;
+	vc4_bo_cache_bucket buckets[BO_CACHE_NUM_BUCKETS];
+	vc4_bo_cache_entry* oldest;
+	vc4_bo_cache_entry* newest;
+	uint32_t maxAge; //in ms, 0 disables the cache
+	int hasMadvise;
+	uint32_t numEntries;
+	uint64_t cachedSize;
+	uint32_t hits, misses, busy, purged, evicted, retries;
+} boCache = { .mutex = PTHREAD_MUTEX_INITIALIZER };
+
+static uint64_t boCacheTime()
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (uint64_t)t.tv_sec * 1000 + t.tv_nsec / 1000000;
+}
+
+static vc4_bo_cache_bucket* boCacheBucket(uint32_t size)
+{
+	uint32_t pages = size / ARM_PAGE_SIZE;
+	return &boCache.buckets[(pages < BO_CACHE_NUM_BUCKETS ? pages : BO_CACHE_NUM_BUCKETS) - 1];
+}
+
+static void boCacheRemove(vc4_bo_cache_entry* e)
+{
+	vc4_bo_cache_bucket* b = boCacheBucket(e->size);
+
+	if(e->prev) e->prev->next = e->next;
+	else b->first = e->next;
+	if(e->next) e->next->prev = e->prev;
+	else b->last = e->prev;
+
+	if(e->older) e->older->newer = e->newer;
+	else boCache.oldest = e->newer;
+	if(e->newer) e->newer->older = e->older;
+	else boCache.newest = e->older;
+
+	boCache.numEntries--;
+	boCache.cachedSize -= e->size;
+}
+
+//free BOs that sat in the cache for longer than maxAge
+static void boCacheFreeStale(int fd, uint64_t now)
+{
+	while(boCache.oldest && now - boCache.oldest->freeTime >= boCache.maxAge)
+	{
+		vc4_bo_cache_entry* e = boCache.oldest;
+		boCacheRemove(e);
+		vc4_bo_free(fd, e->bo, 0, e->size);
+		free(e);
+		boCache.evicted++;
+	}
+}
+
+//returns 0 if there is no idle BO of this size
+static uint32_t vc4_bo_from_cache(int fd, uint32_t size)
+{
+	if(!boCache.maxAge)
+	{
+		return 0;
+	}
+
+	pthread_mutex_lock(&boCache.mutex);
+
+	//the oldest BOs of a bucket are the most likely to be idle
+	//one still in use by the GPU would stall whoever maps it, so skip it for the next one of the same size
+	vc4_bo_cache_entry* e = boCacheBucket(size)->first;
+	for(; e; e = e->next)
+	{
+		if(e->size != size)
+		{
+			continue;
+		}
+
+		if(vc4_bo_wait_busy(fd, e->bo, 0))
+		{
+			break;
+		}
+
+		boCache.busy++;
+	}
+
+	if(!e)
+	{
+		boCache.misses++;
+		pthread_mutex_unlock(&boCache.mutex);
+		return 0;
+	}
+
+	boCacheRemove(e);
+	uint32_t bo = e->bo;
+	free(e);
+
+	//the kernel may have dropped the backing pages while the BO was purgeable
+	if(!vc4_bo_unpurgeable(fd, bo, boCache.hasMadvise))
+	{
+		vc4_bo_free(fd, bo, 0, size);
+		boCache.purged++;
+		boCache.misses++;
+		pthread_mutex_unlock(&boCache.mutex);
+		return 0;
+	}
+
+	boCache.hits++;
+	pthread_mutex_unlock(&boCache.mutex);
+
+	return bo;
+}
+
+//RPI_VK_BO_CACHE_MAX_AGE sets how many ms freed BOs are kept, 0 turns the cache off
+void vc4_bo_cache_init(int hasMadvise)
+{
+	pthread_mutex_lock(&boCache.mutex);
+
+	boCache.hasMadvise = hasMadvise;
+	boCache.maxAge = BO_CACHE_DEFAULT_MAX_AGE;
+
+	const char* env = getenv("RPI_VK_BO_CACHE_MAX_AGE");
+	if(env)
+	{
+		boCache.maxAge = strtoul(env, 0, 10);
+	}
+
+	pthread_mutex_unlock(&boCache.mutex);
+}
+
+//hands a BO allocated with vc4_bo_alloc back to the cache, or frees it if the cache is off
+void vc4_bo_cache_put(int fd, uint32_t bo, void* mappedAddr, uint32_t size)
+{
+	assert(fd);
+	assert(bo);
+	assert(size);
+
+	size = getBOAlignedSize(size);
+
+	if(!boCache.maxAge)
+	{
+		vc4_bo_free(fd, bo, mappedAddr, size);
+		return;
+	}
+
+	vc4_bo_cache_entry* e = malloc(sizeof(vc4_bo_cache_entry));
+	if(!e)
+	{
+		vc4_bo_free(fd, bo, mappedAddr, size);
+		return;
+	}
+
+	if(mappedAddr)
+	{
+		vc4_bo_unmap_unsynchronized(fd, mappedAddr, size);
+	}
+
+	//let the kernel reclaim the memory under pressure while the BO is unused
+	vc4_bo_purgeable(fd, bo, boCache.hasMadvise);
+
+	pthread_mutex_lock(&boCache.mutex);
+
+	uint64_t now = boCacheTime();
+	boCacheFreeStale(fd, now);
+
+	e->bo = bo;
+	e->size = size;
+	e->freeTime = now;
+
+	vc4_bo_cache_bucket* b = boCacheBucket(size);
+	e->next = 0;
+	e->prev = b->last;
+	if(b->last) b->last->next = e;
+	else b->first = e;
+	b->last = e;
+
+	e->newer = 0;
+	e->older = boCache.newest;
+	if(boCache.newest) boCache.newest->newer = e;
+	else boCache.oldest = e;
+	boCache.newest = e;
+
+	boCache.numEntries++;
+	boCache.cachedSize += size;
+
+	pthread_mutex_unlock(&boCache.mutex);
+}
+
+//returns the number of BOs freed
+static uint32_t boCacheFreeAllLocked(int fd)
+{
+	uint32_t num = 0;
+	while(boCache.oldest)
+	{
+		vc4_bo_cache_entry* e = boCache.oldest;
+		boCacheRemove(e);
+		vc4_bo_free(fd, e->bo, 0, e->size);
+		free(e);
+		num++;
+	}
+
+	return num;
+}
+
+void vc4_bo_cache_free_all(int fd)
+{
+	assert(fd);
+
+	pthread_mutex_lock(&boCache.mutex);
+	boCacheFreeAllLocked(fd);
+	pthread_mutex_unlock(&boCache.mutex);
+
+	if(traceEnabled(TRACE_BO))
+	{
+		vc4_bo_cache_dump_stats();
+	}
+}
+
+void vc4_bo_cache_dump_stats()
+{
+	pthread_mutex_lock(&boCache.mutex);
+
+	uint32_t lookups = boCache.hits + boCache.misses;
+	printf("BO cache: %u hits, %u misses, %.1f%% hit rate\n", boCache.hits, boCache.misses, lookups ? 100.0f * boCache.hits / lookups : 0.0f);
+	printf("BO cache: %u skipped as busy, %u purged by the kernel, %u evicted, %u allocations retried\n", boCache.busy, boCache.purged, boCache.evicted, boCache.retries);
+	printf("BO cache: %u BOs, %llu bytes cached\n", boCache.numEntries, (unsigned long long)boCache.cachedSize);
+
+	pthread_mutex_unlock(&boCache.mutex);
+}
+
 uint32_t vc4_bo_alloc(int fd, uint32_t size, const char *name)
 {
 	assert(fd);
@@ -370,39 +764,50 @@ uint32_t vc4_bo_alloc(int fd, uint32_t size, const char *name)
 	struct drm_vc4_create_bo create;
 	int ret;
 
-	/*bo = vc4_bo_from_cache(screen, size, name);
-		if (bo) {
-				if (dump_stats) {
-						fprintf(stderr, "Allocated %s %dkb from cache:\n",
-								name, size / 1024);
-						vc4_bo_dump_stats(screen);
-				}
-				return bo;
-		}*/
+	size = getBOAlignedSize(size);
+
+	uint32_t cached = vc4_bo_from_cache(fd, size);
+	if(cached)
+	{
+		traceBoAlloc(cached, size);
+		return cached;
+	}
 
 	memset(&create, 0, sizeof(create));
 	create.size = size;
 
 	ret = drmIoctl(fd, DRM_IOCTL_VC4_CREATE_BO, &create);
+
+	if (ret != 0) {
+		//the kernel may be out of memory because of what we hold in the cache
+		pthread_mutex_lock(&boCache.mutex);
+		uint32_t freed = boCacheFreeAllLocked(fd);
+		if(freed)
+		{
+			boCache.retries++;
+		}
+		pthread_mutex_unlock(&boCache.mutex);
+
+		if(freed)
+		{
+			ret = drmIoctl(fd, DRM_IOCTL_VC4_CREATE_BO, &create);
+		}
+	}
+
 	uint32_t handle = create.handle;
 
 	if (ret != 0) {
 		printf("Couldn't alloc BO: %s\n",
 			   strerror(errno));
-
-		/*if (!list_empty(&screen->bo_cache.time_list) &&
-					!cleared_and_retried) {
-						cleared_and_retried = true;
-						vc4_bo_cache_free_all(&screen->bo_cache);
-						goto retry;
-				}
-
-				free(bo);*/
 		return 0;
 	}
 
 	vc4_bo_label(fd, handle, name);
 
+	boBusyTrack(handle, 0);
+
+	traceBoAlloc(handle, size);
+
 	return handle;
 }
 
@@ -417,6 +822,11 @@ void vc4_bo_free(int fd, uint32_t bo, void* mappedAddr, uint32_t size)
 		//VG(VALGRIND_FREELIKE_BLOCK(bo->map, 0));
 	}
 
+	traceBoFree(bo);
+
+	//the handle may be reused for an imported BO
+	boBusyTrack(bo, BO_BUSY_UNTRACKED);
+
 	struct drm_gem_close c;
 	memset(&c, 0, sizeof(c));
 	c.handle = bo;
@@ -511,6 +921,135 @@ int vc4_bo_get_dmabuf(int fd, uint32_t bo)
 	return boFd;
 }
 
+//returns 0 on failure, which is also the "no syncobj" value of in_sync/out_sync
+uint32_t vc4_syncobj_create(int fd, int signaled)
+{
+	assert(fd);
+
+	struct drm_syncobj_create create = {
+		.flags = signaled ? DRM_SYNCOBJ_CREATE_SIGNALED : 0,
+	};
+
+	if (drmIoctl(fd, DRM_IOCTL_SYNCOBJ_CREATE, &create))
+	{
+		printf("Syncobj create failed: %s\n", strerror(errno));
+		return 0;
+	}
+
+	return create.handle;
+}
+
+void vc4_syncobj_destroy(int fd, uint32_t syncobj)
+{
+	assert(fd);
+	assert(syncobj);
+
+	struct drm_syncobj_destroy destroy = {
+		.handle = syncobj,
+	};
+
+	if (drmIoctl(fd, DRM_IOCTL_SYNCOBJ_DESTROY, &destroy))
+	{
+		printf("Syncobj destroy failed: %s\n", strerror(errno));
+	}
+}
+
+//waits until every syncobj has a fence and all of them are signaled, timeout is relative
+//returns 0 on timeout or error
+int vc4_syncobj_wait(int fd, const uint32_t* syncobjs, uint32_t count, uint64_t timeout_ns)
+{
+	assert(fd);
+	assert(syncobjs);
+
+	uint64_t now = vc4_time_ns();
+
+	struct drm_syncobj_wait wait = {
+		.handles = (uintptr_t)syncobjs,
+		.timeout_nsec = timeout_ns > INT64_MAX - now ? INT64_MAX : now + timeout_ns,
+		.count_handles = count,
+		.flags = DRM_SYNCOBJ_WAIT_FLAGS_WAIT_ALL | DRM_SYNCOBJ_WAIT_FLAGS_WAIT_FOR_SUBMIT,
+	};
+
+	if (drmIoctl(fd, DRM_IOCTL_SYNCOBJ_WAIT, &wait))
+	{
+		if (errno != ETIME)
+		{
+			printf("Syncobj wait failed: %s\n", strerror(errno));
+		}
+		return 0;
+	}
+
+	return 1;
+}
+
+static void vc4_syncobj_array_op(int fd, unsigned long request, const uint32_t* syncobjs, uint32_t count)
+{
+	struct drm_syncobj_array array = {
+		.handles = (uintptr_t)syncobjs,
+		.count_handles = count,
+	};
+
+	if (drmIoctl(fd, request, &array))
+	{
+		printf("Syncobj reset/signal failed: %s\n", strerror(errno));
+	}
+}
+
+//removes the fences, so waits with WAIT_FOR_SUBMIT block until a new one is attached
+void vc4_syncobj_reset(int fd, const uint32_t* syncobjs, uint32_t count)
+{
+	assert(fd);
+	assert(syncobjs);
+
+	vc4_syncobj_array_op(fd, DRM_IOCTL_SYNCOBJ_RESET, syncobjs, count);
+}
+
+//attaches an already signaled fence
+void vc4_syncobj_signal(int fd, const uint32_t* syncobjs, uint32_t count)
+{
+	assert(fd);
+	assert(syncobjs);
+
+	vc4_syncobj_array_op(fd, DRM_IOCTL_SYNCOBJ_SIGNAL, syncobjs, count);
+}
+
+//makes dst signal together with the fence currently in src
+int vc4_syncobj_copy(int fd, uint32_t dst, uint32_t src)
+{
+	assert(fd);
+	assert(dst);
+	assert(src);
+
+	struct drm_syncobj_handle exp = {
+		.handle = src,
+		.flags = DRM_SYNCOBJ_HANDLE_TO_FD_FLAGS_EXPORT_SYNC_FILE,
+		.fd = -1,
+	};
+
+	if (drmIoctl(fd, DRM_IOCTL_SYNCOBJ_HANDLE_TO_FD, &exp))
+	{
+		printf("Syncobj export failed: %s\n", strerror(errno));
+		return 0;
+	}
+
+	struct drm_syncobj_handle imp = {
+		.handle = dst,
+		.flags = DRM_SYNCOBJ_FD_TO_HANDLE_FLAGS_IMPORT_SYNC_FILE,
+		.fd = exp.fd,
+	};
+
+	int ret = drmIoctl(fd, DRM_IOCTL_SYNCOBJ_FD_TO_HANDLE, &imp);
+	close(exp.fd);
+
+	if (ret)
+	{
+		printf("Syncobj import failed: %s\n", strerror(errno));
+		return 0;
+	}
+
+	return 1;
+}
+
 void* vc4_bo_map(int fd, uint32_t bo, uint32_t offset, uint32_t size)
 {
 	assert(fd);
@@ -519,8 +1058,8 @@ void* vc4_bo_map(int fd, uint32_t bo, uint32_t offset, uint32_t size)
 
 	void* map = vc4_bo_map_unsynchronized(fd, bo, offset, size);
 
-	//wait infinitely
-	int ok = vc4_bo_wait(fd, bo, WAIT_TIMEOUT_INFINITE);
+	//wait infinitely, if the BO has work in flight
+	int ok = vc4_bo_wait_busy(fd, bo, WAIT_TIMEOUT_INFINITE);
 	if (!ok) {
 		printf("BO wait for map failed: %s\n", strerror(errno));
 		return 0;
@@ -529,12 +1068,20 @@ void* vc4_bo_map(int fd, uint32_t bo, uint32_t offset, uint32_t size)
 	return map;
 }
 
-void vc4_cl_submit(int fd, struct drm_vc4_submit_cl* submit, uint64_t* lastEmittedSeqno, uint64_t* lastFinishedSeqno)
+//CLOCK_MONOTONIC in ns, the clock seqno and syncobj timeouts are measured against
+uint64_t vc4_time_ns()
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (uint64_t)t.tv_sec * 1000000000ull + t.tv_nsec;
+}
+
+//throttling is up to the caller
+void vc4_cl_submit(int fd, struct drm_vc4_submit_cl* submit, uint64_t* lastEmittedSeqno)
 {
 	assert(fd);
 	assert(submit);
 	assert(lastEmittedSeqno);
-	assert(lastFinishedSeqno);
 
 	int ret = drmIoctl(fd, DRM_IOCTL_VC4_SUBMIT_CL, submit);
 
@@ -545,16 +1092,6 @@ void vc4_cl_submit(int fd, struct drm_vc4_submit_cl* submit, uint64_t* lastEmitt
 		warned = 1;
 	} else if (!ret) {
 		*lastEmittedSeqno = submit->seqno;
-	}
-
-	if (*lastEmittedSeqno - *lastFinishedSeqno > 5) {
-		uint64_t timeout = WAIT_TIMEOUT_INFINITE;
-		if (!vc4_seqno_wait(fd,
-							lastFinishedSeqno,
-							*lastFinishedSeqno > 0 ? *lastEmittedSeqno - 5 : *lastEmittedSeqno,
-							&timeout))
-		{
-			printf("Job throttling failed\n");
-		}
+		boBusyMark(submit);
 	}
 }
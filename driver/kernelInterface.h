@@ -34,6 +34,11 @@ extern "C" {
 #define WAIT_TIMEOUT_INFINITE 0xffffffffffffffffull
 #define ARM_PAGE_SIZE 4096
 
+//number of size buckets of the BO cache, the last one holds all larger sizes
+#define BO_CACHE_NUM_BUCKETS 256
+//how long freed BOs are kept for reuse in ms, overridden by RPI_VK_BO_CACHE_MAX_AGE
+#define BO_CACHE_DEFAULT_MAX_AGE 1000
+
 extern int controlFd;
 //extern int renderFd;
 
@@ -42,6 +47,7 @@ void closeIoctl();
 
 int vc4_get_chip_info(int fd);
 int vc4_has_feature(int fd, uint32_t feature);
+int vc4_has_capability(int fd, uint64_t capability);
 int vc4_test_tiling(int fd);
 uint64_t vc4_bo_get_tiling(int fd, uint32_t bo, uint64_t mod);
 int vc4_bo_set_tiling(int fd, uint32_t bo, uint64_t mod);
@@ -51,17 +57,30 @@ void vc4_bo_unmap_unsynchronized(int fd, void* ptr, uint32_t size);
 int vc4_bo_wait(int fd, uint32_t bo, uint64_t timeout_ns);
 //int vc4_seqno_wait_ioctl(int fd, uint64_t seqno, uint64_t timeout_ns);
 int vc4_seqno_wait(int fd, uint64_t* lastFinishedSeqno, uint64_t seqno, uint64_t* timeout_ns);
+int vc4_bo_wait_busy(int fd, uint32_t bo, uint64_t timeout_ns);
+uint64_t vc4_last_finished_seqno();
 int vc4_bo_flink(int fd, uint32_t bo, uint32_t *name);
 uint32_t vc4_bo_alloc_shader(int fd, const void *data, uint32_t* size);
 uint32_t vc4_bo_open_name(int fd, uint32_t name);
 uint32_t vc4_bo_alloc(int fd, uint32_t size, const char *name);
 void vc4_bo_free(int fd, uint32_t bo, void* mappedAddr, uint32_t size);
+void vc4_bo_cache_init(int hasMadvise);
+void vc4_bo_cache_put(int fd, uint32_t bo, void* mappedAddr, uint32_t size);
+void vc4_bo_cache_free_all(int fd);
+void vc4_bo_cache_dump_stats();
 int vc4_bo_unpurgeable(int fd, uint32_t bo, int hasMadvise);
 void vc4_bo_purgeable(int fd, uint32_t bo, int hasMadvise);
 void vc4_bo_label(int fd, uint32_t bo, const char* name);
 int vc4_bo_get_dmabuf(int fd, uint32_t bo);
 void* vc4_bo_map(int fd, uint32_t bo, uint32_t offset, uint32_t size);
-void vc4_cl_submit(int fd, struct drm_vc4_submit_cl* submit, uint64_t* lastEmittedSeqno, uint64_t* lastFinishedSeqno);
+uint32_t vc4_syncobj_create(int fd, int signaled);
+void vc4_syncobj_destroy(int fd, uint32_t syncobj);
+int vc4_syncobj_wait(int fd, const uint32_t* syncobjs, uint32_t count, uint64_t timeout_ns);
+void vc4_syncobj_reset(int fd, const uint32_t* syncobjs, uint32_t count);
+void vc4_syncobj_signal(int fd, const uint32_t* syncobjs, uint32_t count);
+int vc4_syncobj_copy(int fd, uint32_t dst, uint32_t src);
+uint64_t vc4_time_ns();
+void vc4_cl_submit(int fd, struct drm_vc4_submit_cl* submit, uint64_t* lastEmittedSeqno);
 uint32_t getBOAlignedSize(uint32_t size);
 
 //TODO perfmon
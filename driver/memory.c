@@ -2,6 +2,9 @@
 
 #include "kernel/vc4_packet.h"
 
+//protects the BO of lazily allocated memory, which command buffers on any thread may commit
+static pthread_mutex_t lazyMemoryMutex = PTHREAD_MUTEX_INITIALIZER;
+
 /*
  * https://www.khronos.org/registry/vulkan/specs/1.1-extensions/html/vkspec.html#vkGetPhysicalDeviceMemoryProperties
  */
@@ -56,6 +59,115 @@ void vkGetPhysicalDeviceMemoryProperties(VkPhysicalDevice physicalDevice, VkPhys
 	}
 }
 
+//carve size bytes out of a slab, creating a new slab if none has room
+//returns 0 if out of device memory
+static uint32_t memorySlabAllocate(_device* dev, _deviceMemory* mem, uint32_t size)
+{
+	uint32_t numBlocks = divRoundUp(size, ARM_PAGE_SIZE);
+
+	pthread_mutex_lock(&dev->memoryMutex);
+
+	_memorySlab* slab = dev->memorySlabs;
+	uint32_t block = OFFSET_ALLOCATOR_INVALID;
+	for(; slab; slab = slab->next)
+	{
+		block = offsetAllocate(&slab->oa, numBlocks);
+		if(block != OFFSET_ALLOCATOR_INVALID)
+		{
+			break;
+		}
+	}
+
+	if(!slab)
+	{
+		//slabs outlive the allocation they were created for, so they don't use its allocation callbacks
+		slab = malloc(sizeof(_memorySlab));
+		if(!slab)
+		{
+			pthread_mutex_unlock(&dev->memoryMutex);
+			return 0;
+		}
+
+		slab->bo = vc4_bo_alloc(controlFd, DEVICE_MEMORY_SLAB_SIZE, "vkAllocateMemory slab");
+		slab->oa = createOffsetAllocator(DEVICE_MEMORY_SLAB_SIZE / ARM_PAGE_SIZE, 0);
+		if(slab->bo)
+		{
+			block = offsetAllocate(&slab->oa, numBlocks);
+		}
+
+		if(block == OFFSET_ALLOCATOR_INVALID)
+		{
+			if(slab->bo)
+			{
+				vc4_bo_cache_put(controlFd, slab->bo, 0, DEVICE_MEMORY_SLAB_SIZE);
+			}
+			destroyOffsetAllocator(&slab->oa, 0);
+			free(slab);
+			pthread_mutex_unlock(&dev->memoryMutex);
+			return 0;
+		}
+
+		slab->mappedPtr = 0;
+		slab->numAllocations = 0;
+		slab->numMapped = 0;
+		slab->next = dev->memorySlabs;
+		dev->memorySlabs = slab;
+	}
+
+	slab->numAllocations++;
+
+	pthread_mutex_unlock(&dev->memoryMutex);
+
+	mem->bo = slab->bo;
+	mem->offset = block * ARM_PAGE_SIZE;
+	mem->slab = slab;
+
+	return 1;
+}
+
+static void memorySlabDestroy(_memorySlab* slab)
+{
+	vc4_bo_cache_put(controlFd, slab->bo, slab->mappedPtr, DEVICE_MEMORY_SLAB_SIZE);
+	destroyOffsetAllocator(&slab->oa, 0);
+	free(slab);
+}
+
+static void memorySlabFree(_device* dev, _deviceMemory* mem)
+{
+	_memorySlab* slab = mem->slab;
+
+	pthread_mutex_lock(&dev->memoryMutex);
+
+	offsetFree(&slab->oa, mem->offset / ARM_PAGE_SIZE, divRoundUp(mem->size, ARM_PAGE_SIZE));
+	slab->numAllocations--;
+
+	//empty slabs are released, except for the last one to avoid churn
+	if(!slab->numAllocations && (dev->memorySlabs != slab || slab->next))
+	{
+		_memorySlab** prev = &dev->memorySlabs;
+		while(*prev != slab)
+		{
+			prev = &(*prev)->next;
+		}
+		*prev = slab->next;
+
+		memorySlabDestroy(slab);
+	}
+
+	pthread_mutex_unlock(&dev->memoryMutex);
+}
+
+//releases the slabs at device destruction, whatever the application did not free is gone too
+void deviceFreeMemorySlabs(_device* dev)
+{
+	while(dev->memorySlabs)
+	{
+		_memorySlab* slab = dev->memorySlabs;
+		dev->memorySlabs = slab->next;
+		memorySlabDestroy(slab);
+	}
+}
+
 /*
  * https://www.khronos.org/registry/vulkan/specs/1.1-extensions/html/vkspec.html#vkAllocateMemory
  */
@@ -65,10 +177,17 @@ VkResult vkAllocateMemory(VkDevice device, const VkMemoryAllocateInfo* pAllocate
 	assert(pAllocateInfo);
 	assert(pMemory);
 
-	uint32_t bo = vc4_bo_alloc(controlFd, pAllocateInfo->allocationSize, "vkAllocateMemory");
-	if(!bo)
+	_device* dev = device;
+
+	//memory that is dedicated to an image or buffer gets its own BO, eg. swapchain images need that for scanout
+	uint32_t dedicated = 0;
+	//every extension struct starts with sType and pNext
+	for(const VkMemoryDedicatedAllocateInfo* next = pAllocateInfo->pNext; next; next = next->pNext)
 	{
-		return VK_ERROR_OUT_OF_DEVICE_MEMORY;
+		if(next->sType == VK_STRUCTURE_TYPE_MEMORY_DEDICATED_ALLOCATE_INFO)
+		{
+			dedicated = next->image || next->buffer;
+		}
 	}
 
 	_deviceMemory* mem = ALLOCATE(sizeof(_deviceMemory), 1, VK_SYSTEM_ALLOCATION_SCOPE_OBJECT);
@@ -77,10 +196,39 @@ VkResult vkAllocateMemory(VkDevice device, const VkMemoryAllocateInfo* pAllocate
 		return VK_ERROR_OUT_OF_HOST_MEMORY;
 	}
 
-	mem->bo = bo;
+	if(memoryTypes[pAllocateInfo->memoryTypeIndex].propertyFlags & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT)
+	{
+		//committed by memoryCommit once a render pass has to load or store it
+		mem->bo = 0;
+		mem->offset = 0;
+		mem->slab = 0;
+	}
+	else if(dev->suballocate && !dedicated && pAllocateInfo->allocationSize <= DEVICE_MEMORY_MAX_SUBALLOCATION)
+	{
+		if(!memorySlabAllocate(dev, mem, pAllocateInfo->allocationSize))
+		{
+			FREE(mem);
+			return VK_ERROR_OUT_OF_DEVICE_MEMORY;
+		}
+	}
+	else
+	{
+		mem->bo = vc4_bo_alloc(controlFd, pAllocateInfo->allocationSize, "vkAllocateMemory");
+		mem->offset = 0;
+		mem->slab = 0;
+		if(!mem->bo)
+		{
+			FREE(mem);
+			return VK_ERROR_OUT_OF_DEVICE_MEMORY;
+		}
+	}
+
 	mem->size = pAllocateInfo->allocationSize;
 	mem->memTypeIndex = pAllocateInfo->memoryTypeIndex;
 	mem->mappedPtr = 0;
+	mem->cpuMapping = 0;
+	mem->prevMapping = 0;
+	mem->nextMapping = 0;
 
 	*pMemory = mem;
 
@@ -89,6 +237,81 @@ VkResult vkAllocateMemory(VkDevice device, const VkMemoryAllocateInfo* pAllocate
 	return VK_SUCCESS;
 }
 
+//returns the CPU address of the start of the allocation, mapping its BO if it isn't mapped yet
+//must be called with memoryMutex held
+static char* memoryGetMapping(_device* dev, _deviceMemory* mem)
+{
+	if(mem->slab)
+	{
+		if(!mem->slab->mappedPtr)
+		{
+			mem->slab->mappedPtr = vc4_bo_map_unsynchronized(controlFd, mem->slab->bo, 0, DEVICE_MEMORY_SLAB_SIZE);
+		}
+
+		return mem->slab->mappedPtr ? (char*)mem->slab->mappedPtr + mem->offset : 0;
+	}
+
+	if(!mem->cpuMapping)
+	{
+		mem->cpuMapping = vc4_bo_map_unsynchronized(controlFd, mem->bo, 0, mem->size);
+		if(mem->cpuMapping)
+		{
+			mem->prevMapping = 0;
+			mem->nextMapping = dev->cachedMappings;
+			if(dev->cachedMappings) dev->cachedMappings->prevMapping = mem;
+			dev->cachedMappings = mem;
+		}
+	}
+
+	return mem->cpuMapping;
+}
+
+//removes mem from the cached mappings and returns its mapping, which the caller has to unmap
+//must be called with memoryMutex held
+static void* memoryUnlinkMapping(_device* dev, _deviceMemory* mem)
+{
+	void* mapping = mem->cpuMapping;
+	if(!mapping)
+	{
+		return 0;
+	}
+
+	if(mem->prevMapping) mem->prevMapping->nextMapping = mem->nextMapping;
+	else dev->cachedMappings = mem->nextMapping;
+	if(mem->nextMapping) mem->nextMapping->prevMapping = mem->prevMapping;
+
+	mem->cpuMapping = 0;
+	mem->prevMapping = 0;
+	mem->nextMapping = 0;
+
+	return mapping;
+}
+
+//unmaps every cached mapping the application isn't using right now, to make room in the address space
+//must be called with memoryMutex held
+static void deviceTrimMappings(_device* dev)
+{
+	_deviceMemory* mem = dev->cachedMappings;
+	while(mem)
+	{
+		_deviceMemory* next = mem->nextMapping;
+		if(!mem->mappedPtr)
+		{
+			vc4_bo_unmap_unsynchronized(controlFd, memoryUnlinkMapping(dev, mem), mem->size);
+		}
+		mem = next;
+	}
+
+	for(_memorySlab* slab = dev->memorySlabs; slab; slab = slab->next)
+	{
+		if(slab->mappedPtr && !slab->numMapped)
+		{
+			vc4_bo_unmap_unsynchronized(controlFd, slab->mappedPtr, DEVICE_MEMORY_SLAB_SIZE);
+			slab->mappedPtr = 0;
+		}
+	}
+}
+
 /*
  * https://www.khronos.org/registry/vulkan/specs/1.1-extensions/html/vkspec.html#vkMapMemory
  */
@@ -111,16 +334,43 @@ VkResult vkMapMemory(VkDevice device, VkDeviceMemory memory, VkDeviceSize offset
 	//TODO check ppdata alignment
 	//TODO multiple instances?
 
-	void* ptr = vc4_bo_map(controlFd, ((_deviceMemory*)memory)->bo, offset, size);
-	if(!ptr)
+	_device* dev = device;
+	_deviceMemory* mem = memory;
+
+	//BOs are mapped whole once and the mapping is kept,
+	//so mapping the same memory again is just pointer arithmetic
+	pthread_mutex_lock(&dev->memoryMutex);
+
+	char* base = memoryGetMapping(dev, mem);
+	if(!base)
+	{
+		//likely out of address space, retry after releasing the mappings nobody uses
+		deviceTrimMappings(dev);
+		base = memoryGetMapping(dev, mem);
+	}
+
+	if(base && mem->slab)
+	{
+		mem->slab->numMapped++;
+	}
+
+	pthread_mutex_unlock(&dev->memoryMutex);
+
+	if(!base)
 	{
 		return VK_ERROR_MEMORY_MAP_FAILED;
 	}
 
-	((_deviceMemory*)memory)->mappedPtr = ptr;
-	((_deviceMemory*)memory)->mappedOffset = offset;
-	((_deviceMemory*)memory)->mappedSize = size;
-	*ppData = ptr;
+	//slabs are shared by unrelated allocations, waiting on them would stall on work that doesn't touch this memory
+	if(!mem->slab && !vc4_bo_wait_busy(controlFd, mem->bo, WAIT_TIMEOUT_INFINITE))
+	{
+		printf("BO wait for map failed: %s\n", strerror(errno));
+	}
+
+	mem->mappedPtr = base + offset;
+	mem->mappedOffset = offset;
+	mem->mappedSize = size == VK_WHOLE_SIZE ? mem->size - offset : size;
+	*ppData = mem->mappedPtr;
 
 	return VK_SUCCESS;
 }
@@ -133,7 +383,60 @@ void vkUnmapMemory(VkDevice device, VkDeviceMemory memory)
 	assert(device);
 	assert(memory);
 
-	vc4_bo_unmap_unsynchronized(controlFd, ((_deviceMemory*)memory)->mappedPtr, ((_deviceMemory*)memory)->mappedSize);
+	_device* dev = device;
+	_deviceMemory* mem = memory;
+
+	//the mapping itself stays cached until the memory is freed
+	if(mem->slab)
+	{
+		pthread_mutex_lock(&dev->memoryMutex);
+		mem->slab->numMapped--;
+		pthread_mutex_unlock(&dev->memoryMutex);
+	}
+
+	mem->mappedPtr = 0;
+}
+
+//returns the BO backing mem, lazily allocated memory gets one the first time a job has to load or store it
+//returns 0 if that allocation fails
+uint32_t memoryCommit(_deviceMemory* mem)
+{
+	assert(mem);
+
+	if(!(memoryTypes[mem->memTypeIndex].propertyFlags & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT))
+	{
+		return mem->bo;
+	}
+
+	pthread_mutex_lock(&lazyMemoryMutex);
+	if(!mem->bo)
+	{
+		mem->bo = vc4_bo_alloc(controlFd, mem->size, "lazily allocated memory");
+	}
+	uint32_t bo = mem->bo;
+	pthread_mutex_unlock(&lazyMemoryMutex);
+
+	return bo;
+}
+
+/*
+ * https://www.khronos.org/registry/vulkan/specs/1.1-extensions/html/vkspec.html#vkGetDeviceMemoryCommitment
+ * The implementation may update the commitment at any time, and the value returned by this query may be out of date.
+ */
+VKAPI_ATTR void VKAPI_CALL vkGetDeviceMemoryCommitment(
+	VkDevice                                    device,
+	VkDeviceMemory                              memory,
+	VkDeviceSize*                               pCommittedMemoryInBytes)
+{
+	assert(device);
+	assert(memory);
+	assert(pCommittedMemoryInBytes);
+
+	_deviceMemory* mem = memory;
+
+	pthread_mutex_lock(&lazyMemoryMutex);
+	*pCommittedMemoryInBytes = mem->bo ? mem->size : 0;
+	pthread_mutex_unlock(&lazyMemoryMutex);
 }
 
 void vkFreeMemory(VkDevice device, VkDeviceMemory memory, const VkAllocationCallbacks* pAllocator)
@@ -141,8 +444,30 @@ void vkFreeMemory(VkDevice device, VkDeviceMemory memory, const VkAllocationCall
 	assert(device);
 	assert(memory);
 
+	_device* dev = device;
 	_deviceMemory* mem = memory;
-	vc4_bo_free(controlFd, mem->bo, mem->mappedPtr, mem->size);
+
+	//freeing memory implicitly unmaps it
+	if(mem->mappedPtr)
+	{
+		vkUnmapMemory(device, memory);
+	}
+
+	if(mem->slab)
+	{
+		memorySlabFree(dev, mem);
+	}
+	else
+	{
+		pthread_mutex_lock(&dev->memoryMutex);
+		void* mapping = memoryUnlinkMapping(dev, mem);
+		pthread_mutex_unlock(&dev->memoryMutex);
+
+		if(mem->bo)
+		{
+			vc4_bo_cache_put(controlFd, mem->bo, mapping, mem->size);
+		}
+	}
 	FREE(mem);
 }
 
@@ -13,10 +13,12 @@ void vkCmdBindPipeline(VkCommandBuffer commandBuffer, VkPipelineBindPoint pipeli
 	if(pipelineBindPoint == VK_PIPELINE_BIND_POINT_GRAPHICS)
 	{
 		cb->graphicsPipeline = pipeline;
+		cb->dirty |= CMDBUF_DIRTY_GRAPHICS_PIPELINE;
 	}
 	else if(pipelineBindPoint == VK_PIPELINE_BIND_POINT_COMPUTE)
 	{
 		cb->computePipeline = pipeline;
+		cb->dirty |= CMDBUF_DIRTY_COMPUTE_PIPELINE;
 	}
 }
 
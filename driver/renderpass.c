@@ -2,6 +2,406 @@
 
 #include "kernel/vc4_packet.h"
 
+//tiles are 64x64 pixels, halved for msaa and halved vertically for 64 bit color
+static void getTileSize(VkFormat format, VkSampleCountFlagBits samples, uint32_t* tileSizeW, uint32_t* tileSizeH)
+{
+	*tileSizeW = 64;
+	*tileSizeH = 64;
+
+	if(samples > 1)
+	{
+		*tileSizeW >>= 1;
+		*tileSizeH >>= 1;
+	}
+
+	if(getFormatBpp(format) == 64)
+	{
+		*tileSizeH >>= 1;
+	}
+}
+
+//points surf at the memory bound to i
+//lazily allocated memory is only committed here, when a job actually has to load or store it
+static void setSurface(VkCommandBuffer commandBuffer, struct drm_vc4_submit_rcl_surface* surf, _image* i)
+{
+	uint32_t bo = memoryCommit(i->boundMem);
+	if(!bo)
+	{
+		//the job can't be submitted without the surface, vkEndCommandBuffer reports the failure
+		commandBuffer->recordResult = VK_ERROR_OUT_OF_DEVICE_MEMORY;
+		return;
+	}
+
+	clFit(commandBuffer, &commandBuffer->handlesCl, 4);
+	surf->hindex = clGetHandleIndex(&commandBuffer->handlesCl, &commandBuffer->handlesHash, bo);
+	surf->offset = i->boundMem->offset + i->boundOffset;
+}
+
+//sets up the render side of a new job rendering to rt in commandBuffer->submitCl
+//only the tiles touched by renderArea are loaded and stored, null means the whole image
+//surfaces are only read from and written to memory if rt->ops asks for it
+static void jobBegin(VkCommandBuffer commandBuffer, const _renderTarget* rt, const VkRect2D* renderArea)
+{
+	assert(commandBuffer);
+	assert(rt);
+	assert(rt->color || rt->depthStencil);
+
+	//the job's dimensions come from whichever surface there is
+	_image* i = rt->color ? rt->color : rt->depthStencil;
+	_image* ds = rt->depthStencil;
+	uint32_t msaa = i->samples > 1;
+
+	assert(!ds || ds->samples == i->samples);
+
+	//a resolve is just another store of the color tile buffer, with decimation
+	_image* resolve = rt->resolve;
+	assert(!resolve || (msaa && rt->color && resolve->samples == 1));
+	assert(!resolve || (resolve->width == i->width && resolve->height == i->height));
+
+	struct drm_vc4_submit_cl submitCl =
+	{
+		.color_read.hindex = ~0,
+		.zs_read.hindex = ~0,
+		.color_write.hindex = ~0,
+		.msaa_color_write.hindex = ~0,
+		.zs_write.hindex = ~0,
+		.msaa_zs_write.hindex = ~0,
+	};
+
+	//CL pointers are offsets into the command buffer's CLs until the job is submitted
+	submitCl.bin_cl = clTotalSize(&commandBuffer->binCl);
+	submitCl.shader_rec = clSize(&commandBuffer->shaderRecCl);
+	submitCl.shader_rec_count = commandBuffer->shaderRecCount;
+	submitCl.uniforms = clSize(&commandBuffer->uniformsCl);
+
+	//the render config is needed even if color isn't stored, it sets up the tile buffer
+	//color_write is the decimated store, so with msaa it describes the resolve target
+	//TODO format
+	submitCl.color_write.bits =
+			VC4_SET_FIELD(VC4_RENDER_CONFIG_FORMAT_RGBA8888, VC4_RENDER_CONFIG_FORMAT) |
+			VC4_SET_FIELD(resolve ? resolve->tiling : i->tiling, VC4_RENDER_CONFIG_MEMORY_FORMAT) |
+			(msaa ? VC4_RENDER_CONFIG_MS_MODE_4X | VC4_RENDER_CONFIG_DECIMATE_MODE_4X : 0);
+
+	//multisampled surfaces are loaded and stored with every sample, those take no bits
+	if(rt->color && (rt->ops & TILE_LOAD_COLOR))
+	{
+		setSurface(commandBuffer, &submitCl.color_read, i);
+		if(msaa)
+		{
+			submitCl.color_read.flags = VC4_SUBMIT_RCL_SURFACE_READ_IS_FULL_RES;
+		}
+		else
+		{
+			submitCl.color_read.bits =
+					VC4_SET_FIELD(VC4_LOADSTORE_TILE_BUFFER_COLOR, VC4_LOADSTORE_TILE_BUFFER_BUFFER) |
+					VC4_SET_FIELD(VC4_LOADSTORE_TILE_BUFFER_RGBA8888, VC4_LOADSTORE_TILE_BUFFER_FORMAT) |
+					VC4_SET_FIELD(i->tiling, VC4_LOADSTORE_TILE_BUFFER_TILING);
+		}
+	}
+
+	if(rt->color && (rt->ops & TILE_STORE_COLOR))
+	{
+		setSurface(commandBuffer, msaa ? &submitCl.msaa_color_write : &submitCl.color_write, i);
+	}
+
+	//the samples themselves are only written to memory if they are stored as well
+	if(resolve)
+	{
+		setSurface(commandBuffer, &submitCl.color_write, resolve);
+	}
+
+	if(ds && (rt->ops & TILE_LOAD_ZS))
+	{
+		setSurface(commandBuffer, &submitCl.zs_read, ds);
+		if(msaa)
+		{
+			submitCl.zs_read.flags = VC4_SUBMIT_RCL_SURFACE_READ_IS_FULL_RES;
+		}
+		else
+		{
+			submitCl.zs_read.bits =
+					VC4_SET_FIELD(VC4_LOADSTORE_TILE_BUFFER_ZS, VC4_LOADSTORE_TILE_BUFFER_BUFFER) |
+					VC4_SET_FIELD(ds->tiling, VC4_LOADSTORE_TILE_BUFFER_TILING);
+		}
+	}
+
+	if(ds && (rt->ops & TILE_STORE_ZS))
+	{
+		if(msaa)
+		{
+			setSurface(commandBuffer, &submitCl.msaa_zs_write, ds);
+		}
+		else
+		{
+			setSurface(commandBuffer, &submitCl.zs_write, ds);
+			submitCl.zs_write.bits =
+					VC4_SET_FIELD(VC4_LOADSTORE_TILE_BUFFER_ZS, VC4_LOADSTORE_TILE_BUFFER_BUFFER) |
+					VC4_SET_FIELD(ds->tiling, VC4_LOADSTORE_TILE_BUFFER_TILING);
+		}
+	}
+
+	submitCl.clear_color[0] = rt->clearColor[0];
+	submitCl.clear_color[1] = rt->clearColor[1];
+
+	uint32_t tileSizeW, tileSizeH;
+	getTileSize(i->format, i->samples, &tileSizeW, &tileSizeH);
+
+	uint32_t minX = 0, minY = 0, maxX = i->width, maxY = i->height;
+	if(renderArea)
+	{
+		minX = min(renderArea->offset.x, i->width);
+		minY = min(renderArea->offset.y, i->height);
+		maxX = min(renderArea->offset.x + renderArea->extent.width, i->width);
+		maxY = min(renderArea->offset.y + renderArea->extent.height, i->height);
+	}
+
+	//round out to whole tiles, an empty area still needs one tile for a valid job
+	submitCl.min_x_tile = minX / tileSizeW;
+	submitCl.min_y_tile = minY / tileSizeH;
+	submitCl.max_x_tile = max(divRoundUp(maxX, tileSizeW), submitCl.min_x_tile + 1) - 1;
+	submitCl.max_y_tile = max(divRoundUp(maxY, tileSizeH), submitCl.min_y_tile + 1) - 1;
+	submitCl.width = i->width;
+	submitCl.height = i->height;
+	submitCl.flags |= VC4_SUBMIT_CL_USE_CLEAR_COLOR;
+	submitCl.clear_z = rt->clearDepth;
+	submitCl.clear_s = rt->clearStencil;
+
+	//memory traffic of the tile loads and stores, compared to loading and storing everything
+	uint32_t numTiles = (submitCl.max_x_tile - submitCl.min_x_tile + 1) * (submitCl.max_y_tile - submitCl.min_y_tile + 1);
+	uint32_t colorTileBytes = rt->color ? tileSizeW * tileSizeH * (msaa ? 4 * 4 : getFormatBpp(i->format) / 8) : 0;
+	uint32_t zsTileBytes = ds ? tileSizeW * tileSizeH * (msaa ? 4 : 1) * 4 : 0;
+	uint32_t resolveTileBytes = resolve ? tileSizeW * tileSizeH * getFormatBpp(resolve->format) / 8 : 0;
+	uint32_t bytesLoaded = numTiles * ((rt->ops & TILE_LOAD_COLOR ? colorTileBytes : 0) + (rt->ops & TILE_LOAD_ZS ? zsTileBytes : 0));
+	uint32_t bytesStored = numTiles * ((rt->ops & TILE_STORE_COLOR ? colorTileBytes : 0) + (rt->ops & TILE_STORE_ZS ? zsTileBytes : 0) + resolveTileBytes);
+	traceRenderPass(numTiles, bytesLoaded, bytesStored, numTiles * (2 * (colorTileBytes + zsTileBytes) + resolveTileBytes) - bytesLoaded - bytesStored);
+
+	commandBuffer->submitCl = submitCl;
+}
+
+//closes the job started by jobBegin, its size is whatever got recorded in between
+static void jobEnd(VkCommandBuffer commandBuffer)
+{
+	struct drm_vc4_submit_cl* submitCl = &commandBuffer->submitCl;
+	submitCl->bin_cl_size = clTotalSize(&commandBuffer->binCl) - submitCl->bin_cl;
+	submitCl->shader_rec_size = clSize(&commandBuffer->shaderRecCl) - submitCl->shader_rec;
+	submitCl->shader_rec_count = commandBuffer->shaderRecCount - submitCl->shader_rec_count;
+	submitCl->uniforms_size = clSize(&commandBuffer->uniformsCl) - submitCl->uniforms;
+
+	clFit(commandBuffer, &commandBuffer->jobsCl, sizeof(struct drm_vc4_submit_cl));
+	memcpy(commandBuffer->jobsCl.nextFreeByte, submitCl, sizeof(struct drm_vc4_submit_cl));
+	commandBuffer->jobsCl.nextFreeByte += sizeof(struct drm_vc4_submit_cl);
+	commandBuffer->numJobs++;
+}
+
+//starts a new job rendering to rt, everything recorded up to binningEnd is submitted as one vc4 job
+void binningBegin(VkCommandBuffer commandBuffer, const _renderTarget* rt, const VkRect2D* renderArea)
+{
+	assert(commandBuffer);
+
+	jobBegin(commandBuffer, rt, renderArea);
+
+	_image* i = rt->color ? rt->color : rt->depthStencil;
+
+	//Tile Binning Mode Configuration
+	clFit(commandBuffer, &commandBuffer->binCl, V3D21_TILE_BINNING_MODE_CONFIGURATION_length);
+	clInsertTileBinningModeConfiguration(&commandBuffer->binCl,
+										 0, 0, 0, 0,
+										 getFormatBpp(i->format) == 64, //64 bit color mode
+										 i->samples > 1, //msaa
+										 i->width, i->height, 0, 0, 0);
+
+	//START_TILE_BINNING resets the statechange counters in the hardware,
+	//which are what is used when a primitive is binned to a tile to
+	//figure out what new state packets need to be written to that tile's
+	//command list.
+	clFit(commandBuffer, &commandBuffer->binCl, V3D21_START_TILE_BINNING_length);
+	clInsertStartTileBinning(&commandBuffer->binCl);
+
+	//Reset the current compressed primitives format.  This gets modified
+	//by VC4_PACKET_GL_INDEXED_PRIMITIVE and
+	//VC4_PACKET_GL_ARRAY_PRIMITIVE, so it needs to be reset at the start
+	//of every tile.
+	clFit(commandBuffer, &commandBuffer->binCl, V3D21_PRIMITIVE_LIST_FORMAT_length);
+	clInsertPrimitiveListFormat(&commandBuffer->binCl,
+								1, //16 bit
+								2); //tris
+
+	//new binning job, draws have to emit their state again
+	commandBuffer->shadow.validMask = 0;
+}
+
+void binningEnd(VkCommandBuffer commandBuffer)
+{
+	assert(commandBuffer);
+
+	//Increment the semaphore indicating that binning is done and
+	//unblocking the render thread.  Note that this doesn't act
+	//until the FLUSH completes.
+	//The FLUSH caps all of our bin lists with a
+	//VC4_PACKET_RETURN.
+	clFit(commandBuffer, &commandBuffer->binCl, V3D21_INCREMENT_SEMAPHORE_length);
+	clInsertIncrementSemaphore(&commandBuffer->binCl);
+	clFit(commandBuffer, &commandBuffer->binCl, V3D21_FLUSH_length);
+	clInsertFlush(&commandBuffer->binCl);
+
+	jobEnd(commandBuffer);
+}
+
+//records a clear of clear->image, replacing any earlier clear of it that is still pending
+void commandBufferAddClear(VkCommandBuffer commandBuffer, const _pendingClear* clear)
+{
+	assert(commandBuffer);
+	assert(clear);
+
+	for(uint32_t c = 0; c < commandBuffer->numPendingClears; ++c)
+	{
+		if(commandBuffer->pendingClears[c].image == clear->image)
+		{
+			commandBuffer->pendingClears[c] = *clear;
+			return;
+		}
+	}
+
+	if(commandBuffer->numPendingClears == CMDBUF_MAX_PENDING_CLEARS)
+	{
+		commandBufferFlushClears(commandBuffer);
+	}
+
+	commandBuffer->pendingClears[commandBuffer->numPendingClears++] = *clear;
+}
+
+//removes the pending clear of i, returns 0 if there is none
+static uint32_t commandBufferTakeClear(VkCommandBuffer commandBuffer, _image* i, _pendingClear* clear)
+{
+	for(uint32_t c = 0; c < commandBuffer->numPendingClears; ++c)
+	{
+		if(commandBuffer->pendingClears[c].image == i)
+		{
+			*clear = commandBuffer->pendingClears[c];
+			commandBuffer->pendingClears[c] = commandBuffer->pendingClears[--commandBuffer->numPendingClears];
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+//a job rendering to area only touches the whole image if area covers it
+static uint32_t renderAreaCoversImage(const VkRect2D* area, const _image* i)
+{
+	return area->offset.x <= 0 && area->offset.y <= 0 &&
+		   area->offset.x + (int32_t)area->extent.width >= (int32_t)i->width &&
+		   area->offset.y + (int32_t)area->extent.height >= (int32_t)i->height;
+}
+
+//whether a job rendering to area only touches whole tiles, the edges of the image count as tile boundaries
+//tiles the area only partially covers are still stored whole, see jobBegin
+static uint32_t renderAreaIsTileAligned(const VkRect2D* area, const _image* i)
+{
+	uint32_t tileSizeW, tileSizeH;
+	getTileSize(i->format, i->samples, &tileSizeW, &tileSizeH);
+
+	uint32_t maxX = area->offset.x + area->extent.width;
+	uint32_t maxY = area->offset.y + area->extent.height;
+
+	return !(area->offset.x % tileSizeW) && !(area->offset.y % tileSizeH) &&
+		   (!(maxX % tileSizeW) || maxX >= i->width) &&
+		   (!(maxY % tileSizeH) || maxY >= i->height);
+}
+
+//emits a job for each pending clear, which only clears the tiles and stores them
+//nothing needs to be binned for that, so these jobs have an empty bin CL:
+//the kernel then skips binning and tile allocation and only runs the render CL
+void commandBufferFlushClears(VkCommandBuffer commandBuffer)
+{
+	assert(commandBuffer);
+
+	uint32_t numPendingClears = commandBuffer->numPendingClears;
+	commandBuffer->numPendingClears = 0;
+
+	for(uint32_t c = 0; c < numPendingClears; ++c)
+	{
+		const _pendingClear* clear = &commandBuffer->pendingClears[c];
+
+		_renderTarget rt = { .clearDepth = clear->clearDepth, .clearStencil = clear->clearStencil };
+		rt.clearColor[0] = clear->clearColor[0];
+		rt.clearColor[1] = clear->clearColor[1];
+
+		if(isDepthStencilFormat(clear->image->format))
+		{
+			rt.depthStencil = clear->image;
+			rt.ops = TILE_STORE_ZS;
+		}
+		else
+		{
+			rt.color = clear->image;
+			rt.ops = TILE_STORE_COLOR;
+		}
+
+		jobBegin(commandBuffer, &rt, 0);
+		jobEnd(commandBuffer);
+	}
+}
+
+/*
+ * https://www.khronos.org/registry/vulkan/specs/1.1-extensions/html/vkspec.html#vkCmdResolveImage
+ */
+VKAPI_ATTR void VKAPI_CALL vkCmdResolveImage(
+	VkCommandBuffer                             commandBuffer,
+	VkImage                                     srcImage,
+	VkImageLayout                               srcImageLayout,
+	VkImage                                     dstImage,
+	VkImageLayout                               dstImageLayout,
+	uint32_t                                    regionCount,
+	const VkImageResolve*                       pRegions)
+{
+	assert(commandBuffer);
+	assert(srcImage);
+	assert(dstImage);
+	assert(!regionCount || pRegions);
+
+	assert(commandBuffer->state == CMDBUF_STATE_RECORDING);
+
+	_image* src = srcImage;
+	_image* dst = dstImage;
+
+	assert(src->samples > 1);
+	assert(dst->samples == 1);
+
+	//src is loaded into the tile buffer with all its samples and resolved when the tiles are stored,
+	//nothing needs to be binned for that
+	//TODO a pending clear of src could be the job's clear color instead of loading it
+	commandBufferFlushClears(commandBuffer);
+
+	for(uint32_t c = 0; c < regionCount; ++c)
+	{
+		const VkImageResolve* r = &pRegions[c];
+		VkRect2D area = { { r->srcOffset.x, r->srcOffset.y }, { r->extent.width, r->extent.height } };
+
+		//TODO only the first mip level and array layer have memory, see vkCreateImage
+		assert(!r->srcSubresource.mipLevel && !r->srcSubresource.baseArrayLayer &&
+			   !r->dstSubresource.mipLevel && !r->dstSubresource.baseArrayLayer);
+
+		//TODO tiles are stored where they were loaded from, moving a region needs a draw sampling src
+		assert(r->srcOffset.x == r->dstOffset.x && r->srcOffset.y == r->dstOffset.y);
+
+		//TODO the tile buffer holds the samples of src, so dst can't be loaded to keep what is outside of
+		//the region in tiles it only partially covers, those are resolved whole
+		assert(renderAreaIsTileAligned(&area, src));
+
+		if(r->srcSubresource.mipLevel || r->srcSubresource.baseArrayLayer ||
+		   r->dstSubresource.mipLevel || r->dstSubresource.baseArrayLayer ||
+		   r->srcOffset.x != r->dstOffset.x || r->srcOffset.y != r->dstOffset.y)
+		{
+			continue;
+		}
+		_renderTarget rt = { .color = src, .resolve = dst, .ops = TILE_LOAD_COLOR };
+
+		jobBegin(commandBuffer, &rt, &area);
+		jobEnd(commandBuffer);
+	}
+}
+
 /*
  * https://www.khronos.org/registry/vulkan/specs/1.1-extensions/html/vkspec.html#vkCmdBeginRenderPass
  */
@@ -20,22 +420,114 @@ void vkCmdBeginRenderPass(VkCommandBuffer commandBuffer, const VkRenderPassBegin
 	cb->renderpass = pRenderPassBegin->renderPass;
 	cb->renderArea = pRenderPassBegin->renderArea;
 
-	for(int c = 0; c < pRenderPassBegin->clearValueCount; ++c)
+	cb->currentSubpass = 0;
+	cb->dirty |= CMDBUF_DIRTY_SUBPASS;
+
+	//TODO handle multiple attachments etc.
+	const VkSubpassDescription* sp = &cb->renderpass->subpasses[0];
+	uint32_t colorAttachment = sp->pColorAttachments[0].attachment;
+	const VkAttachmentDescription* color = &cb->renderpass->attachments[colorAttachment];
+
+	_renderTarget rt = { .color = cb->fbo->attachmentViews[colorAttachment].image };
+	_pendingClear clear;
+
+	//tiles at the edges of an unaligned render area are stored whole, so if they are stored at all
+	//they have to be loaded first to keep what is outside of the render area
+	uint32_t aligned = renderAreaIsTileAligned(&cb->renderArea, rt.color);
+
+	//CLEAR and DONT_CARE both start from a cleared tile, so only LOAD reads memory
+	//and nothing is written back for STORE_OP_DONT_CARE
+	uint32_t storeColor = color->storeOp == VK_ATTACHMENT_STORE_OP_STORE;
+	uint32_t loadColor = color->loadOp == VK_ATTACHMENT_LOAD_OP_LOAD || (!aligned && storeColor);
+
+	//TODO a loaded tile isn't cleared, clearing just the render area needs a quad drawn over it
+	//until then the area keeps its old contents
+	assert(!loadColor || color->loadOp != VK_ATTACHMENT_LOAD_OP_CLEAR);
+
+	if(color->loadOp == VK_ATTACHMENT_LOAD_OP_CLEAR && colorAttachment < pRenderPassBegin->clearValueCount)
+	{
+		rt.clearColor[0] = rt.clearColor[1] = packVec4IntoABGR8(pRenderPassBegin->pClearValues[colorAttachment].color.float32);
+	}
+
+	//a pending clear of the image becomes this job's clear color instead of a job of its own,
+	//if the pass clears or discards the image anyway the pending clear is simply dropped
+	//this only works if the job covers the whole image, otherwise the clear gets its own job below
+	if(renderAreaCoversImage(&cb->renderArea, rt.color) && commandBufferTakeClear(cb, rt.color, &clear) && loadColor)
 	{
-		if(cb->renderpass->attachments[c].loadOp == VK_ATTACHMENT_LOAD_OP_CLEAR)
+		rt.clearColor[0] = clear.clearColor[0];
+		rt.clearColor[1] = clear.clearColor[1];
+	}
+	else if(loadColor)
+	{
+		rt.ops |= TILE_LOAD_COLOR;
+	}
+
+	if(storeColor)
+	{
+		rt.ops |= TILE_STORE_COLOR;
+	}
+
+	//the resolve happens while the tiles are stored, in this same job
+	//a pending clear of the resolve target would be overwritten, unless the job only covers part of it
+	if(sp->pResolveAttachments && sp->pResolveAttachments[0].attachment != VK_ATTACHMENT_UNUSED)
+	{
+		rt.resolve = cb->fbo->attachmentViews[sp->pResolveAttachments[0].attachment].image;
+
+		//TODO the resolve target can't be loaded into the multisampled tile buffer,
+		//so edge tiles of an unaligned render area are resolved whole
+		assert(aligned);
+
+		if(renderAreaCoversImage(&cb->renderArea, rt.resolve))
 		{
-			cb->fbo->attachmentViews[c].image->needToClear = 1;
-			cb->fbo->attachmentViews[c].image->clearColor[0] = cb->fbo->attachmentViews[c].image->clearColor[1] = packVec4IntoABGR8(pRenderPassBegin->pClearValues->color.float32);
+			commandBufferTakeClear(cb, rt.resolve, &clear);
 		}
-		else if(isDepthStencilFormat(cb->renderpass->attachments[c].format) && cb->renderpass->attachments[c].stencilLoadOp == VK_ATTACHMENT_LOAD_OP_CLEAR)
+	}
+
+	if(sp->pDepthStencilAttachment && sp->pDepthStencilAttachment->attachment != VK_ATTACHMENT_UNUSED)
+	{
+		uint32_t dsAttachment = sp->pDepthStencilAttachment->attachment;
+		const VkAttachmentDescription* ds = &cb->renderpass->attachments[dsAttachment];
+		rt.depthStencil = cb->fbo->attachmentViews[dsAttachment].image;
+
+		VkImageAspectFlags aspects = getDepthStencilAspects(ds->format);
+		uint32_t hasDepth = aspects & VK_IMAGE_ASPECT_DEPTH_BIT;
+		uint32_t hasStencil = aspects & VK_IMAGE_ASPECT_STENCIL_BIT;
+
+		//depth and stencil are loaded and stored together, so one aspect needing memory costs both
+		uint32_t store = (hasDepth && ds->storeOp == VK_ATTACHMENT_STORE_OP_STORE) || (hasStencil && ds->stencilStoreOp == VK_ATTACHMENT_STORE_OP_STORE);
+		uint32_t load = (hasDepth && ds->loadOp == VK_ATTACHMENT_LOAD_OP_LOAD) || (hasStencil && ds->stencilLoadOp == VK_ATTACHMENT_LOAD_OP_LOAD) || (!aligned && store);
+
+		//TODO a loaded tile isn't cleared, so an aspect can only be cleared if nothing is loaded
+		//clearing one aspect while the other is loaded needs a quad drawn that only writes the cleared aspect,
+		//until then the cleared aspect keeps its old contents
+		assert(!load || !((hasDepth && ds->loadOp == VK_ATTACHMENT_LOAD_OP_CLEAR) || (hasStencil && ds->stencilLoadOp == VK_ATTACHMENT_LOAD_OP_CLEAR)));
+
+		if(dsAttachment < pRenderPassBegin->clearValueCount)
+		{
+			rt.clearDepth = pRenderPassBegin->pClearValues[dsAttachment].depthStencil.depth * 0xffffff;
+			rt.clearStencil = pRenderPassBegin->pClearValues[dsAttachment].depthStencil.stencil & 0xff;
+		}
+
+		if(renderAreaCoversImage(&cb->renderArea, rt.depthStencil) && commandBufferTakeClear(cb, rt.depthStencil, &clear) && load)
+		{
+			rt.clearDepth = clear.clearDepth;
+			rt.clearStencil = clear.clearStencil;
+		}
+		else if(load)
+		{
+			rt.ops |= TILE_LOAD_ZS;
+		}
+
+		if(store)
 		{
-			//TODO how to pack depth/stencil clear values???
-			//cb->fbo->attachmentViews[c].image->needToClear = 1;
-			//cb->fbo->attachmentViews[c].image->clearColor = packVec4IntoABGR8(pRenderPassBegin->pClearValues->depthStencil.depth);
+			rt.ops |= TILE_STORE_ZS;
 		}
 	}
 
-	cb->currentSubpass = 0;
+	//the pass might sample the other images, so their clears have to happen first
+	commandBufferFlushClears(cb);
+
+	binningBegin(cb, &rt, &cb->renderArea);
 }
 
 /*
@@ -47,6 +539,8 @@ void vkCmdEndRenderPass(VkCommandBuffer commandBuffer)
 
 	//TODO switch command buffer to next control record stream?
 	//Ending a render pass instance performs any multisample resolve operations on the final subpass
+
+	binningEnd(commandBuffer);
 }
 
 /*
@@ -271,6 +765,7 @@ VKAPI_ATTR void VKAPI_CALL vkCmdNextSubpass(
 
 	_commandBuffer* cb = commandBuffer;
 	cb->currentSubpass++; //TODO check max subpass?
+	cb->dirty |= CMDBUF_DIRTY_SUBPASS;
 }
 
 /*
@@ -289,19 +784,8 @@ VKAPI_ATTR void VKAPI_CALL vkGetRenderAreaGranularity(
 
 	//TODO what if we have multiple attachments?
 
-	uint32_t tileSizeW = 64;
-	uint32_t tileSizeH = 64;
-
-	if(rp->attachments[0].samples > 1)
-	{
-		tileSizeW >>= 1;
-		tileSizeH >>= 1;
-	}
-
-	if(getFormatBpp(rp->attachments[0].format) == 64)
-	{
-		tileSizeH >>= 1;
-	}
+	uint32_t tileSizeW, tileSizeH;
+	getTileSize(rp->attachments[0].format, rp->attachments[0].samples, &tileSizeW, &tileSizeH);
 
 	pGranularity->width = tileSizeW;
 	pGranularity->height = tileSizeH;
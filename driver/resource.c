@@ -68,7 +68,7 @@ void vkGetBufferMemoryRequirements(VkDevice device, VkBuffer buffer, VkMemoryReq
 
 	pMemoryRequirements->alignment = ((_buffer*)buffer)->alignment;
 	pMemoryRequirements->size = ((_buffer*)buffer)->alignedSize;
-	pMemoryRequirements->memoryTypeBits = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT; //TODO
+	pMemoryRequirements->memoryTypeBits = ((1 << numMemoryTypes) - 1) & ~(1 << MEMORY_TYPE_LAZILY_ALLOCATED);
 }
 
 /*
@@ -187,8 +187,6 @@ VKAPI_ATTR VkResult VKAPI_CALL vkCreateImage(
 	i->format = pCreateInfo->format;
 	i->imageSpace = 0;
 	i->tiling = pCreateInfo->tiling == VK_IMAGE_TILING_LINEAR ? VC4_TILING_FORMAT_LT : VC4_TILING_FORMAT_T;
-	i->needToClear = 0;
-	i->clearColor[0] = i->clearColor[1] = 0;
 	i->layout = pCreateInfo->initialLayout;
 	i->boundMem = 0;
 	i->boundOffset = 0;
@@ -227,8 +225,10 @@ VKAPI_ATTR void VKAPI_CALL vkDestroyImage(
 
 	_image* i = image;
 
-	if(i->numQueueFamiliesWithAccess > 0);
+	if(i->numQueueFamiliesWithAccess > 0)
+	{
 		FREE(i->queueFamiliesWithAccess);
+	}
 
 	FREE(i);
 }
@@ -263,8 +263,13 @@ VKAPI_ATTR void VKAPI_CALL vkGetImageMemoryRequirements(
 	i->stride = i->paddedWidth * pixelSizeBytes;
 
 	pMemoryRequirements->alignment = ARM_PAGE_SIZE;
-	pMemoryRequirements->memoryTypeBits = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT; //TODO
+	pMemoryRequirements->memoryTypeBits = ((1 << numMemoryTypes) - 1) & ~(1 << MEMORY_TYPE_LAZILY_ALLOCATED);
 	pMemoryRequirements->size = i->size;
+
+	if(i->usageBits & VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT)
+	{
+		pMemoryRequirements->memoryTypeBits |= 1 << MEMORY_TYPE_LAZILY_ALLOCATED;
+	}
 }
 
 /*
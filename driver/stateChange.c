@@ -17,7 +17,7 @@ void vkCmdSetViewport(VkCommandBuffer commandBuffer, uint32_t firstViewport, uin
 	_commandBuffer* cb = commandBuffer;
 	cb->viewport = pViewports[0];
 
-	cb->viewportDirty = 1;
+	cb->dirty |= CMDBUF_DIRTY_VIEWPORT;
 }
 
 /*
@@ -35,7 +35,7 @@ void vkCmdSetScissor(VkCommandBuffer commandBuffer, uint32_t firstScissor, uint3
 	_commandBuffer* cb = commandBuffer;
 	cb->scissor = pScissors[0];
 
-	cb->scissorDirty = 1;
+	cb->dirty |= CMDBUF_DIRTY_SCISSOR;
 }
 
 /*
@@ -53,7 +53,23 @@ void vkCmdBindVertexBuffers(VkCommandBuffer commandBuffer, uint32_t firstBinding
 		cb->vertexBufferOffsets[firstBinding + c] = pOffsets[c];
 	}
 
-	cb->vertexBufferDirty = 1;
+	cb->dirty |= CMDBUF_DIRTY_VERTEX_BUFFER;
+}
+
+//aspects of the memory backed subresource a clear of pRanges touches
+//only the first mip level and array layer of an image have memory, see vkCreateImage
+static VkImageAspectFlags getClearedAspects(uint32_t rangeCount, const VkImageSubresourceRange* pRanges)
+{
+	VkImageAspectFlags aspects = 0;
+	for(uint32_t c = 0; c < rangeCount; ++c)
+	{
+		if(!pRanges[c].baseMipLevel && !pRanges[c].baseArrayLayer)
+		{
+			aspects |= pRanges[c].aspectMask;
+		}
+	}
+
+	return aspects;
 }
 
 /*
@@ -73,15 +89,8 @@ VKAPI_ATTR void VKAPI_CALL vkCmdClearColorImage(
 	assert(image);
 	assert(pColor);
 
-	//TODO this should only flag an image for clearing. This can only be called outside a renderpass
-	//actual clearing would only happen:
-	// -if image is rendered to (insert clear before first draw call)
-	// -if the image is bound for sampling (submit a CL with a clear)
-	// -if a command buffer is submitted without any rendering (insert clear)
-	// -etc.
-	//we shouldn't clear an image if noone uses it
-
-	//TODO ranges support
+	//the clear is only recorded, it is merged into the next job rendering to the image
+	//or gets a job of its own before anything else could read the image, see _pendingClear
 
 	assert(imageLayout == VK_IMAGE_LAYOUT_GENERAL ||
 		   imageLayout == VK_IMAGE_LAYOUT_SHARED_PRESENT_KHR ||
@@ -96,8 +105,14 @@ VKAPI_ATTR void VKAPI_CALL vkCmdClearColorImage(
 
 	//TODO externally sync cmdbuf, cmdpool
 
-	i->needToClear = 1;
-	i->clearColor[0] = i->clearColor[1] = packVec4IntoABGR8(pColor->float32);
+	if(!(getClearedAspects(rangeCount, pRanges) & VK_IMAGE_ASPECT_COLOR_BIT))
+	{
+		return;
+	}
+
+	_pendingClear clear = { .image = i };
+	clear.clearColor[0] = clear.clearColor[1] = packVec4IntoABGR8(pColor->float32);
+	commandBufferAddClear(commandBuffer, &clear);
 }
 
 /*
@@ -115,7 +130,31 @@ VKAPI_ATTR void VKAPI_CALL vkCmdClearDepthStencilImage(
 	assert(image);
 	assert(pDepthStencil);
 
-	//TODO
+	assert(commandBuffer->state == CMDBUF_STATE_RECORDING);
+
+	_image* i = image;
+
+	assert(i->usageBits & VK_IMAGE_USAGE_TRANSFER_DST_BIT);
+
+	VkImageAspectFlags aspects = getClearedAspects(rangeCount, pRanges) & getDepthStencilAspects(i->format);
+	if(!aspects)
+	{
+		return;
+	}
+
+	//depth and stencil share one tile buffer surface, so a clear of a single aspect
+	//would need the other one loaded first
+	//TODO single aspect clears, until then they are skipped
+	assert(aspects == getDepthStencilAspects(i->format));
+	if(aspects != getDepthStencilAspects(i->format))
+	{
+		return;
+	}
+
+	_pendingClear clear = { .image = i };
+	clear.clearDepth = pDepthStencil->depth * 0xffffff;
+	clear.clearStencil = pDepthStencil->stencil & 0xff;
+	commandBufferAddClear(commandBuffer, &clear);
 }
 
 /*
@@ -132,7 +171,73 @@ VKAPI_ATTR void VKAPI_CALL vkCmdClearAttachments(
 	assert(pAttachments);
 	assert(pRects);
 
-	//TODO
+	_commandBuffer* cb = commandBuffer;
+
+	//before anything was drawn a clear of whole attachments only has to change the job's clear values,
+	//the attachments are then not loaded at all
+	//TODO other clears need a quad drawn over the rects, until then they are skipped
+	uint32_t drawn = cb->shaderRecCount != cb->submitCl.shader_rec_count;
+	assert(!drawn);
+	if(drawn)
+	{
+		return;
+	}
+
+	const VkSubpassDescription* sp = &cb->renderpass->subpasses[cb->currentSubpass];
+
+	for(uint32_t c = 0; c < attachmentCount; ++c)
+	{
+		_image* i = 0;
+		if(pAttachments[c].aspectMask & VK_IMAGE_ASPECT_COLOR_BIT)
+		{
+			//TODO handle multiple attachments etc.
+			if(pAttachments[c].colorAttachment == 0 && sp->pColorAttachments[0].attachment != VK_ATTACHMENT_UNUSED)
+			{
+				i = cb->fbo->attachmentViews[sp->pColorAttachments[0].attachment].image;
+			}
+		}
+		else if(sp->pDepthStencilAttachment && sp->pDepthStencilAttachment->attachment != VK_ATTACHMENT_UNUSED)
+		{
+			i = cb->fbo->attachmentViews[sp->pDepthStencilAttachment->attachment].image;
+		}
+
+		if(!i)
+		{
+			continue;
+		}
+
+		uint32_t wholeImage = 0;
+		for(uint32_t r = 0; r < rectCount; ++r)
+		{
+			const VkRect2D* rect = &pRects[r].rect;
+			wholeImage |= rect->offset.x <= 0 && rect->offset.y <= 0 &&
+						  rect->offset.x + (int32_t)rect->extent.width >= (int32_t)i->width &&
+						  rect->offset.y + (int32_t)rect->extent.height >= (int32_t)i->height;
+		}
+
+		assert(wholeImage);
+		if(!wholeImage)
+		{
+			continue;
+		}
+
+		if(pAttachments[c].aspectMask & VK_IMAGE_ASPECT_COLOR_BIT)
+		{
+			cb->submitCl.color_read = (struct drm_vc4_submit_rcl_surface){ .hindex = ~0 };
+			cb->submitCl.clear_color[0] = cb->submitCl.clear_color[1] = packVec4IntoABGR8(pAttachments[c].clearValue.color.float32);
+			continue;
+		}
+
+		//TODO single aspect clears, see vkCmdClearDepthStencilImage
+		uint32_t allAspects = (pAttachments[c].aspectMask & getDepthStencilAspects(i->format)) == getDepthStencilAspects(i->format);
+		assert(allAspects);
+		if(allAspects)
+		{
+			cb->submitCl.zs_read = (struct drm_vc4_submit_rcl_surface){ .hindex = ~0 };
+			cb->submitCl.clear_z = pAttachments[c].clearValue.depthStencil.depth * 0xffffff;
+			cb->submitCl.clear_s = pAttachments[c].clearValue.depthStencil.stencil & 0xff;
+		}
+	}
 }
 
 /*
@@ -185,7 +290,7 @@ VKAPI_ATTR void VKAPI_CALL vkCmdSetLineWidth(
 	_commandBuffer* cb = commandBuffer;
 	cb->lineWidth = lineWidth;
 
-	cb->lineWidthDirty = 1;
+	cb->dirty |= CMDBUF_DIRTY_LINE_WIDTH;
 }
 
 /*
@@ -204,7 +309,7 @@ VKAPI_ATTR void VKAPI_CALL vkCmdSetDepthBias(
 	cb->depthBiasClamp = depthBiasClamp;
 	cb->depthBiasSlopeFactor = depthBiasSlopeFactor;
 
-	cb->depthBiasDirty = 1;
+	cb->dirty |= CMDBUF_DIRTY_DEPTH_BIAS;
 }
 
 /*
@@ -219,7 +324,7 @@ VKAPI_ATTR void VKAPI_CALL vkCmdSetBlendConstants(
 	_commandBuffer* cb = commandBuffer;
 	memcpy(cb->blendConstants, blendConstants, 4 * sizeof(float));
 
-	cb->blendConstantsDirty = 1;
+	cb->dirty |= CMDBUF_DIRTY_BLEND_CONSTANTS;
 }
 
 /*
@@ -236,7 +341,7 @@ VKAPI_ATTR void VKAPI_CALL vkCmdSetDepthBounds(
 	cb->minDepthBounds = minDepthBounds;
 	cb->maxDepthBounds = maxDepthBounds;
 
-	cb->depthBoundsDirty = 1;
+	cb->dirty |= CMDBUF_DIRTY_DEPTH_BOUNDS;
 }
 
 /*
@@ -261,7 +366,7 @@ VKAPI_ATTR void VKAPI_CALL vkCmdSetStencilCompareMask(
 		cb->stencilCompareMask[1] = compareMask;
 	}
 
-	cb->stencilCompareMaskDirty = 1;
+	cb->dirty |= CMDBUF_DIRTY_STENCIL_COMPARE_MASK;
 }
 
 /*
@@ -286,7 +391,7 @@ VKAPI_ATTR void VKAPI_CALL vkCmdSetStencilWriteMask(
 		cb->stencilWriteMask[1] = writeMask;
 	}
 
-	cb->stencilWriteMaskDirty = 1;
+	cb->dirty |= CMDBUF_DIRTY_STENCIL_WRITE_MASK;
 }
 
 /*
@@ -311,5 +416,5 @@ VKAPI_ATTR void VKAPI_CALL vkCmdSetStencilReference(
 		cb->stencilReference[1] = reference;
 	}
 
-	cb->stencilReferenceDirty = 1;
+	cb->dirty |= CMDBUF_DIRTY_STENCIL_REFERENCE;
 }
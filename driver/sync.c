@@ -1,7 +1,10 @@
+#define _GNU_SOURCE
 #include "common.h"
 
 #include "kernel/vc4_packet.h"
 
+#include <time.h>
+
 /*
  * https://www.khronos.org/registry/vulkan/specs/1.1-extensions/html/vkspec.html#vkCreateSemaphore
  * Semaphores are a synchronization primitive that can be used to insert a dependency between batches submitted to queues.
@@ -24,15 +27,389 @@ VKAPI_ATTR VkResult VKAPI_CALL vkCreateSemaphore(
 	assert(device);
 	assert(pSemaphore);
 
-	//we'll probably just use an IOCTL to wait for a GPU sequence number to complete.
-	sem_t* s = ALLOCATE(sizeof(sem_t), 1, VK_SYSTEM_ALLOCATION_SCOPE_OBJECT);
+	_semaphore* s = ALLOCATE(sizeof(_semaphore), 1, VK_SYSTEM_ALLOCATION_SCOPE_OBJECT);
 	if(!s)
 	{
 		return VK_ERROR_OUT_OF_HOST_MEMORY;
 	}
-	sem_init(s, 0, 0); //create semaphore unsignalled, shared between threads
 
-	*pSemaphore = (VkSemaphore)s;
+	s->isTimeline = 0;
+	s->value = 0;
+	for(const VkSemaphoreTypeCreateInfoKHR* next = pCreateInfo->pNext; next; next = next->pNext)
+	{
+		if(next->sType == VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO_KHR)
+		{
+			s->isTimeline = next->semaphoreType == VK_SEMAPHORE_TYPE_TIMELINE_KHR;
+			s->value = next->initialValue;
+		}
+	}
+
+	atomic_init(&s->hasFence, 0);
+
+	if(s->isTimeline)
+	{
+		//timelines are tracked in userspace against vc4 seqnos
+		s->syncobj = 0;
+		s->points = 0;
+		s->numPoints = 0;
+		s->maxPoints = 0;
+		s->hasAllocator = pAllocator != 0;
+		if(pAllocator)
+		{
+			s->allocator = *pAllocator;
+		}
+		pthread_mutex_init(&s->mutex, 0);
+
+		//timed waits are against CLOCK_MONOTONIC, like the seqno waits
+		pthread_condattr_t attr;
+		pthread_condattr_init(&attr);
+		pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+		pthread_cond_init(&s->cond, &attr);
+		pthread_condattr_destroy(&attr);
+	}
+	else
+	{
+		//created unsignalled, without a fence
+		s->syncobj = device->dev->instance->hasSyncobj ? vc4_syncobj_create(controlFd, 0) : 0;
+		if(!s->syncobj)
+		{
+			sem_init(&s->sem, 0, 0); //shared between threads
+		}
+	}
+
+	*pSemaphore = s;
+
+	return VK_SUCCESS;
+}
+
+//blocks until the semaphore is signaled, then unsignals it
+void semaphoreWait(_semaphore* s)
+{
+	assert(s);
+
+	if(s->syncobj)
+	{
+		vc4_syncobj_wait(controlFd, &s->syncobj, 1, WAIT_TIMEOUT_INFINITE);
+		atomic_store(&s->hasFence, 0);
+		vc4_syncobj_reset(controlFd, &s->syncobj, 1);
+	}
+	else
+	{
+		sem_wait(&s->sem);
+	}
+}
+
+//signals the semaphore right away
+void semaphoreSignal(_semaphore* s)
+{
+	assert(s);
+
+	if(s->syncobj)
+	{
+		vc4_syncobj_signal(controlFd, &s->syncobj, 1);
+		atomic_store(&s->hasFence, 1);
+	}
+	else
+	{
+		sem_post(&s->sem);
+	}
+}
+
+//absolute CLOCK_MONOTONIC deadline of a relative timeout
+static uint64_t timeDeadline(uint64_t timeout)
+{
+	uint64_t now = vc4_time_ns();
+	return timeout > WAIT_TIMEOUT_INFINITE - now ? WAIT_TIMEOUT_INFINITE : now + timeout;
+}
+
+//raises the value to every point whose job is known to have finished, never calls the kernel
+//must be called with the semaphore's mutex held
+static void timelineUpdate(_semaphore* s)
+{
+	if(!s->numPoints)
+	{
+		return;
+	}
+
+	uint64_t finished = vc4_last_finished_seqno();
+	uint32_t numPoints = 0;
+	for(uint32_t c = 0; c < s->numPoints; ++c)
+	{
+		if(s->points[c].seqno <= finished)
+		{
+			s->value = max(s->value, s->points[c].value);
+		}
+		else
+		{
+			s->points[numPoints++] = s->points[c];
+		}
+	}
+
+	s->numPoints = numPoints;
+}
+
+//device signal of a timeline, the value is reached once the job with seqno finishes
+//called by the submit thread, seqno is the queue's last job so 0 or finished seqnos signal right away
+void timelineSignalSeqno(_semaphore* s, uint64_t value, uint64_t seqno)
+{
+	assert(s);
+	assert(s->isTimeline);
+
+	pthread_mutex_lock(&s->mutex);
+
+	if(seqno <= vc4_last_finished_seqno())
+	{
+		s->value = max(s->value, value);
+	}
+	else
+	{
+		if(s->numPoints == s->maxPoints)
+		{
+			const VkAllocationCallbacks* pAllocator = s->hasAllocator ? &s->allocator : 0;
+			uint32_t maxPoints = s->maxPoints ? s->maxPoints * 2 : 8;
+			_timelinePoint* points = ALLOCATE(maxPoints * sizeof(_timelinePoint), 1, VK_SYSTEM_ALLOCATION_SCOPE_OBJECT);
+			if(!points)
+			{
+				//can't track it, so wait for the job instead
+				pthread_mutex_unlock(&s->mutex);
+				uint64_t lastFinishedSeqno = 0;
+				uint64_t timeout = WAIT_TIMEOUT_INFINITE;
+				vc4_seqno_wait(controlFd, &lastFinishedSeqno, seqno, &timeout);
+				pthread_mutex_lock(&s->mutex);
+				s->value = max(s->value, value);
+				pthread_cond_broadcast(&s->cond);
+				pthread_mutex_unlock(&s->mutex);
+				return;
+			}
+
+			if(s->points)
+			{
+				memcpy(points, s->points, s->numPoints * sizeof(_timelinePoint));
+				FREE(s->points);
+			}
+
+			s->points = points;
+			s->maxPoints = maxPoints;
+		}
+
+		s->points[s->numPoints].value = value;
+		s->points[s->numPoints].seqno = seqno;
+		s->numPoints++;
+	}
+
+	pthread_cond_broadcast(&s->cond);
+	pthread_mutex_unlock(&s->mutex);
+}
+
+//device wait of a timeline, resolved by the submit thread before it submits the waiting batch
+//jobs finish in submission order, so it only has to wait until a signal of the value was submitted
+void timelineWaitSubmitted(_semaphore* s, uint64_t value)
+{
+	assert(s);
+	assert(s->isTimeline);
+
+	pthread_mutex_lock(&s->mutex);
+	for(;;)
+	{
+		uint32_t submitted = s->value >= value;
+		for(uint32_t c = 0; c < s->numPoints && !submitted; ++c)
+		{
+			submitted = s->points[c].value >= value;
+		}
+
+		if(submitted)
+		{
+			break;
+		}
+
+		//signaled by the host or a batch that hasn't been submitted yet
+		pthread_cond_wait(&s->cond, &s->mutex);
+	}
+	pthread_mutex_unlock(&s->mutex);
+}
+
+//host wait for a timeline value until the CLOCK_MONOTONIC deadline
+static VkResult timelineWait(_semaphore* s, uint64_t value, uint64_t deadline)
+{
+	pthread_mutex_lock(&s->mutex);
+	for(;;)
+	{
+		timelineUpdate(s);
+		if(s->value >= value)
+		{
+			pthread_mutex_unlock(&s->mutex);
+			return VK_SUCCESS;
+		}
+
+		//the earliest job that reaches the value, if one was submitted
+		uint64_t seqno = 0;
+		for(uint32_t c = 0; c < s->numPoints; ++c)
+		{
+			if(s->points[c].value >= value && (!seqno || s->points[c].seqno < seqno))
+			{
+				seqno = s->points[c].seqno;
+			}
+		}
+
+		uint64_t now = vc4_time_ns();
+		if(now >= deadline)
+		{
+			//still worth asking the kernel once when polling
+			if(seqno)
+			{
+				pthread_mutex_unlock(&s->mutex);
+				uint64_t lastFinishedSeqno = 0;
+				uint64_t timeout = 0;
+				int ret = vc4_seqno_wait(controlFd, &lastFinishedSeqno, seqno, &timeout);
+				return ret > 0 ? VK_SUCCESS : VK_TIMEOUT;
+			}
+
+			pthread_mutex_unlock(&s->mutex);
+			return VK_TIMEOUT;
+		}
+
+		if(seqno)
+		{
+			pthread_mutex_unlock(&s->mutex);
+
+			uint64_t lastFinishedSeqno = 0;
+			uint64_t timeout = deadline == WAIT_TIMEOUT_INFINITE ? WAIT_TIMEOUT_INFINITE : deadline - now;
+			int ret = vc4_seqno_wait(controlFd, &lastFinishedSeqno, seqno, &timeout);
+			if(ret < 0)
+			{
+				return VK_TIMEOUT;
+			}
+			else if(!ret)
+			{
+				return VK_ERROR_DEVICE_LOST;
+			}
+
+			pthread_mutex_lock(&s->mutex);
+			continue;
+		}
+
+		if(deadline == WAIT_TIMEOUT_INFINITE)
+		{
+			pthread_cond_wait(&s->cond, &s->mutex);
+		}
+		else
+		{
+			struct timespec ts = { .tv_sec = deadline / 1000000000ull, .tv_nsec = deadline % 1000000000ull };
+			pthread_cond_timedwait(&s->cond, &s->mutex, &ts);
+		}
+	}
+}
+
+/*
+ * https://www.khronos.org/registry/vulkan/specs/1.1-extensions/html/vkspec.html#vkGetSemaphoreCounterValueKHR
+ */
+VkResult vkGetSemaphoreCounterValueKHR(
+		VkDevice                                    device,
+		VkSemaphore                                 semaphore,
+		uint64_t*                                   pValue)
+{
+	assert(device);
+	assert(semaphore);
+	assert(pValue);
+
+	_semaphore* s = semaphore;
+	assert(s->isTimeline);
+
+	pthread_mutex_lock(&s->mutex);
+	timelineUpdate(s);
+
+	//the cached seqno only advances when someone waits, so ask the kernel about the pending points
+	//in seqno order, jobs finish in that order so the first unfinished one ends the walk
+	while(s->numPoints)
+	{
+		uint64_t seqno = s->points[0].seqno;
+		for(uint32_t c = 1; c < s->numPoints; ++c)
+		{
+			seqno = min(seqno, s->points[c].seqno);
+		}
+
+		uint64_t lastFinishedSeqno = 0;
+		uint64_t timeout = 0;
+		if(vc4_seqno_wait(controlFd, &lastFinishedSeqno, seqno, &timeout) <= 0)
+		{
+			break;
+		}
+
+		//folds in the point and any other that finished with it
+		timelineUpdate(s);
+	}
+
+	*pValue = s->value;
+	pthread_mutex_unlock(&s->mutex);
+
+	return VK_SUCCESS;
+}
+
+/*
+ * https://www.khronos.org/registry/vulkan/specs/1.1-extensions/html/vkspec.html#vkWaitSemaphoresKHR
+ */
+VkResult vkWaitSemaphoresKHR(
+		VkDevice                                    device,
+		const VkSemaphoreWaitInfoKHR*               pWaitInfo,
+		uint64_t                                    timeout)
+{
+	assert(device);
+	assert(pWaitInfo);
+
+	uint64_t deadline = timeDeadline(timeout);
+
+	if(!(pWaitInfo->flags & VK_SEMAPHORE_WAIT_ANY_BIT_KHR))
+	{
+		for(uint32_t c = 0; c < pWaitInfo->semaphoreCount; ++c)
+		{
+			VkResult res = timelineWait(pWaitInfo->pSemaphores[c], pWaitInfo->pValues[c], deadline);
+			if(res != VK_SUCCESS)
+			{
+				return res;
+			}
+		}
+
+		return VK_SUCCESS;
+	}
+
+	//the semaphores may be signaled from anywhere, so wait on each of them in turn
+	//for a share of a 1ms slice, a signal of any of them is noticed within a slice
+	uint64_t share = max(1000000 / pWaitInfo->semaphoreCount, 1);
+	for(;;)
+	{
+		for(uint32_t c = 0; c < pWaitInfo->semaphoreCount; ++c)
+		{
+			VkResult res = timelineWait(pWaitInfo->pSemaphores[c], pWaitInfo->pValues[c], min(timeDeadline(share), deadline));
+			if(res != VK_TIMEOUT)
+			{
+				return res;
+			}
+		}
+
+		if(vc4_time_ns() >= deadline)
+		{
+			return VK_TIMEOUT;
+		}
+	}
+}
+
+/*
+ * https://www.khronos.org/registry/vulkan/specs/1.1-extensions/html/vkspec.html#vkSignalSemaphoreKHR
+ */
+VkResult vkSignalSemaphoreKHR(
+		VkDevice                                    device,
+		const VkSemaphoreSignalInfoKHR*             pSignalInfo)
+{
+	assert(device);
+	assert(pSignalInfo);
+
+	_semaphore* s = pSignalInfo->semaphore;
+	assert(s->isTimeline);
+
+	pthread_mutex_lock(&s->mutex);
+	s->value = max(s->value, pSignalInfo->value);
+	pthread_cond_broadcast(&s->cond);
+	pthread_mutex_unlock(&s->mutex);
 
 	return VK_SUCCESS;
 }
@@ -150,79 +527,7 @@ VKAPI_ATTR void VKAPI_CALL vkCmdPipelineBarrier(
 
 		assert(i->layout == pImageMemoryBarriers[c].oldLayout || i->layout == VK_IMAGE_LAYOUT_UNDEFINED);
 
-		if(srcStageMask & VK_PIPELINE_STAGE_TRANSFER_BIT &&
-		   pImageMemoryBarriers[c].srcAccessMask & VK_ACCESS_TRANSFER_WRITE_BIT &&
-		   i->needToClear)
-		{
-			//insert CRs to clear the image
-
-			assert(i->layout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-
-			clFit(commandBuffer, &commandBuffer->binCl, V3D21_TILE_BINNING_MODE_CONFIGURATION_length);
-			clInsertTileBinningModeConfiguration(&commandBuffer->binCl,
-												 0, 0, 0, 0,
-												 getFormatBpp(i->format) == 64, //64 bit color mode
-												 i->samples > 1, //msaa
-												 i->width, i->height, 0, 0, 0);
-
-			//START_TILE_BINNING resets the statechange counters in the hardware,
-			//which are what is used when a primitive is binned to a tile to
-			//figure out what new state packets need to be written to that tile's
-			//command list.
-			clFit(commandBuffer, &commandBuffer->binCl, V3D21_START_TILE_BINNING_length);
-			clInsertStartTileBinning(&commandBuffer->binCl);
-
-			//Reset the current compressed primitives format.  This gets modified
-			//by VC4_PACKET_GL_INDEXED_PRIMITIVE and
-			//VC4_PACKET_GL_ARRAY_PRIMITIVE, so it needs to be reset at the start
-			//of every tile.
-			clFit(commandBuffer, &commandBuffer->binCl, V3D21_PRIMITIVE_LIST_FORMAT_length);
-			clInsertPrimitiveListFormat(&commandBuffer->binCl,
-										1, //16 bit
-										2); //tris
-
-			clFit(commandBuffer, &commandBuffer->handlesCl, 4);
-			uint32_t idx = clGetHandleIndex(&commandBuffer->handlesCl, i->boundMem->bo);
-			commandBuffer->submitCl.color_write.hindex = idx;
-			commandBuffer->submitCl.color_write.offset = 0;
-			commandBuffer->submitCl.color_write.flags = 0;
-			//TODO format
-			commandBuffer->submitCl.color_write.bits =
-					VC4_SET_FIELD(VC4_RENDER_CONFIG_FORMAT_RGBA8888, VC4_RENDER_CONFIG_FORMAT) |
-					VC4_SET_FIELD(i->tiling, VC4_RENDER_CONFIG_MEMORY_FORMAT);
-
-			commandBuffer->submitCl.clear_color[0] = i->clearColor[0];
-			commandBuffer->submitCl.clear_color[1] = i->clearColor[1];
-
-			//TODO ranges
-			commandBuffer->submitCl.min_x_tile = 0;
-			commandBuffer->submitCl.min_y_tile = 0;
-
-			uint32_t tileSizeW = 64;
-			uint32_t tileSizeH = 64;
-
-			if(i->samples > 1)
-			{
-				tileSizeW >>= 1;
-				tileSizeH >>= 1;
-			}
-
-			if(getFormatBpp(i->format) == 64)
-			{
-				tileSizeH >>= 1;
-			}
-
-			uint32_t widthInTiles = divRoundUp(i->width, tileSizeW);
-			uint32_t heightInTiles = divRoundUp(i->height, tileSizeH);
-
-			commandBuffer->submitCl.max_x_tile = widthInTiles - 1;
-			commandBuffer->submitCl.max_y_tile = heightInTiles - 1;
-			commandBuffer->submitCl.width = i->width;
-			commandBuffer->submitCl.height = i->height;
-			commandBuffer->submitCl.flags |= VC4_SUBMIT_CL_USE_CLEAR_COLOR;
-			commandBuffer->submitCl.clear_z = 0; //TODO
-			commandBuffer->submitCl.clear_s = 0;
-		}
+		//clears recorded before the barrier stay pending until the next job that uses the image, see _pendingClear
 
 		//transition to new layout
 		i->layout = pImageMemoryBarriers[c].newLayout;
@@ -242,7 +547,9 @@ VKAPI_ATTR VkResult VKAPI_CALL vkDeviceWaitIdle(
 	{
 		for(int d = 0; d < device->numQueues[c]; ++d)
 		{
-			uint64_t lastFinishedSeqno;
+			queueWaitForSubmitThread(&device->queues[c][d]);
+
+			uint64_t lastFinishedSeqno = 0;
 			uint64_t timeout = WAIT_TIMEOUT_INFINITE;
 			vc4_seqno_wait(controlFd, &lastFinishedSeqno, device->queues[c][d].lastEmitSeqno, &timeout);
 		}
@@ -260,7 +567,11 @@ VKAPI_ATTR VkResult VKAPI_CALL vkQueueWaitIdle(
 	assert(queue);
 
 	_queue* q = queue;
-	uint64_t lastFinishedSeqno;
+
+	//everything queued must have reached the kernel before we know which seqno to wait for
+	queueWaitForSubmitThread(q);
+
+	uint64_t lastFinishedSeqno = 0;
 	uint64_t timeout = WAIT_TIMEOUT_INFINITE;
 	vc4_seqno_wait(controlFd, &lastFinishedSeqno, q->lastEmitSeqno, &timeout);
 
@@ -278,9 +589,26 @@ VKAPI_ATTR void VKAPI_CALL vkDestroySemaphore(
 	assert(device);
 	assert(semaphore);
 
-	sem_destroy((sem_t*)semaphore);
+	_semaphore* s = semaphore;
+	if(s->isTimeline)
+	{
+		if(s->points)
+		{
+			FREE(s->points);
+		}
+		pthread_cond_destroy(&s->cond);
+		pthread_mutex_destroy(&s->mutex);
+	}
+	else if(s->syncobj)
+	{
+		vc4_syncobj_destroy(controlFd, s->syncobj);
+	}
+	else
+	{
+		sem_destroy(&s->sem);
+	}
 
-	FREE(semaphore);
+	FREE(s);
 }
 
 /*
@@ -297,11 +625,42 @@ VKAPI_ATTR VkResult VKAPI_CALL vkCreateFence(
 	assert(pFence);
 
 	_fence* f = ALLOCATE(sizeof(_fence), 1, VK_SYSTEM_ALLOCATION_SCOPE_OBJECT);
+	if(!f)
+	{
+		return VK_ERROR_OUT_OF_HOST_MEMORY;
+	}
 
+	f->queue = 0;
+	f->jobIndex = 0;
 	f->seqno = 0;
 	f->signaled = pCreateInfo->flags & VK_FENCE_CREATE_SIGNALED_BIT;
 
 	*pFence = f;
+
+	return VK_SUCCESS;
+}
+
+//signals the fence if its seqno is known and the job with that seqno finished, never blocks or calls the kernel
+//returns whether the fence is signaled
+static uint32_t fenceUpdate(_fence* f)
+{
+	if(f->signaled)
+	{
+		return 1;
+	}
+
+	if(!f->queue || !queueJobsDone(f->queue, f->jobIndex))
+	{
+		return 0;
+	}
+
+	if(f->seqno <= vc4_last_finished_seqno())
+	{
+		f->signaled = 1;
+		f->queue = 0;
+	}
+
+	return f->signaled;
 }
 
 /*
@@ -328,10 +687,26 @@ VKAPI_ATTR VkResult VKAPI_CALL vkGetFenceStatus(
 	assert(device);
 	assert(fence);
 
-	//TODO update fence status based on last completed seqno?
-
 	_fence* f = fence;
-	return f->signaled ? VK_SUCCESS : VK_NOT_READY;
+	if(fenceUpdate(f))
+	{
+		return VK_SUCCESS;
+	}
+
+	//the cached seqno only advances when someone waits, so ask the kernel once the fence's seqno is known
+	if(f->queue && queueJobsDone(f->queue, f->jobIndex))
+	{
+		uint64_t lastFinishedSeqno = 0;
+		uint64_t timeout = 0;
+		if(vc4_seqno_wait(controlFd, &lastFinishedSeqno, f->seqno, &timeout) > 0)
+		{
+			f->signaled = 1;
+			f->queue = 0;
+			return VK_SUCCESS;
+		}
+	}
+
+	return VK_NOT_READY;
 }
 
 /*
@@ -349,9 +724,12 @@ VKAPI_ATTR VkResult VKAPI_CALL vkResetFences(
 	for(uint32_t c = 0; c < fenceCount; ++c)
 	{
 		_fence* f = pFences[c];
+		f->queue = 0;
 		f->signaled = 0;
 		f->seqno = 0;
 	}
+
+	return VK_SUCCESS;
 }
 
 /*
@@ -368,79 +746,101 @@ VKAPI_ATTR VkResult VKAPI_CALL vkWaitForFences(
 	assert(pFences);
 	assert(fenceCount > 0);
 
-	if(waitAll)
+	uint64_t deadline = timeDeadline(timeout);
+
+	//jobs finish in seqno order, so waiting for all fences is a wait on the highest seqno
+	//and waiting for any of them is a wait on the lowest
+	uint64_t seqno;
+	uint32_t numPending;
+
+	for(;;)
 	{
-		if(!timeout)
-		{
-			for(uint32_t c = 0; c < fenceCount; ++c)
-			{
-				_fence* f = pFences[c];
-				if(!f->signaled) //if any unsignaled
-				{
-					return VK_TIMEOUT;
-				}
+		seqno = waitAll ? 0 : WAIT_TIMEOUT_INFINITE;
+		numPending = 0;
 
-				return VK_SUCCESS;
-			}
-		}
+		//when waiting for any fence, the one the submit thread gets to first
+		_fence* unprocessed = 0;
 
-		//wait for all to be signaled
 		for(uint32_t c = 0; c < fenceCount; ++c)
 		{
 			_fence* f = pFences[c];
-			uint64_t lastFinishedSeqno = 0;
-			if(!f->signaled)
+			if(fenceUpdate(f))
 			{
-				int ret = vc4_seqno_wait(controlFd, &lastFinishedSeqno, f->seqno, &timeout);
-
-				if(ret < 0)
+				if(!waitAll)
 				{
-					return VK_TIMEOUT;
+					return VK_SUCCESS;
 				}
 
-				f->signaled = 1;
-				f->seqno = 0;
+				continue;
 			}
-		}
-	}
-	else
-	{
-		if(!timeout)
-		{
-			for(uint32_t c = 0; c < fenceCount; ++c)
+
+			if(!f->queue)
 			{
-				_fence* f = pFences[c];
-				if(f->signaled) //if any signaled
+				//never submitted, nothing will signal it
+				if(waitAll)
 				{
-					return VK_SUCCESS;
+					return VK_TIMEOUT;
 				}
 
-				return VK_TIMEOUT;
+				continue;
 			}
-		}
 
-		//wait for any to be signaled
-		for(uint32_t c = 0; c < fenceCount; ++c)
-		{
-			_fence* f = pFences[c];
-			uint64_t lastFinishedSeqno = 0;
-			if(!f->signaled)
+			//the seqno is only known once the submit thread got to the fence,
+			//which can take a while if it waits on a semaphore first
+			if(!queueWaitForJobs(f->queue, f->jobIndex, waitAll ? deadline : 0))
 			{
-				int ret = vc4_seqno_wait(controlFd, &lastFinishedSeqno, f->seqno, &timeout);
+				if(waitAll)
+				{
+					return VK_TIMEOUT;
+				}
 
-				if(ret < 0)
+				if(!unprocessed || f->jobIndex < unprocessed->jobIndex)
 				{
-					continue;
+					unprocessed = f;
 				}
 
-				f->signaled = 1;
-				f->seqno = 0;
-				return VK_SUCCESS;
+				continue;
 			}
+
+			seqno = waitAll ? max(seqno, f->seqno) : min(seqno, f->seqno);
+			numPending++;
+		}
+
+		if(numPending || !unprocessed)
+		{
+			break;
+		}
+
+		//nothing to wait on in the kernel yet
+		if(!queueWaitForJobs(unprocessed->queue, unprocessed->jobIndex, deadline))
+		{
+			return VK_TIMEOUT;
 		}
+	}
+
+	if(!numPending)
+	{
+		return waitAll ? VK_SUCCESS : VK_TIMEOUT;
+	}
 
+	uint64_t now = vc4_time_ns();
+	timeout = deadline == WAIT_TIMEOUT_INFINITE ? WAIT_TIMEOUT_INFINITE : (deadline > now ? deadline - now : 0);
+
+	uint64_t lastFinishedSeqno = 0;
+	int ret = vc4_seqno_wait(controlFd, &lastFinishedSeqno, seqno, &timeout);
+	if(ret < 0)
+	{
 		return VK_TIMEOUT;
 	}
+	else if(!ret)
+	{
+		return VK_ERROR_DEVICE_LOST;
+	}
+
+	for(uint32_t c = 0; c < fenceCount; ++c)
+	{
+		fenceUpdate(pFences[c]);
+	}
 
 	return VK_SUCCESS;
 }
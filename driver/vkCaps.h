@@ -258,6 +258,10 @@ static VkExtensionProperties deviceExtensions[] =
 	{
 		.extensionName = "VK_EXT_display_control",
 		.specVersion = 1
+	},
+	{
+		.extensionName = "VK_KHR_timeline_semaphore",
+		.specVersion = 2
 	}
 };
 #define numDeviceExtensions (sizeof(deviceExtensions) / sizeof(VkExtensionProperties))
@@ -272,8 +276,14 @@ static VkMemoryType memoryTypes[] =
 		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
 		0
 	},
+	{
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT,
+		0
+	},
 };
 #define numMemoryTypes (sizeof(memoryTypes) / sizeof(VkMemoryType))
+//only transient attachments can be bound to it, they only get a BO if a render pass loads or stores them
+#define MEMORY_TYPE_LAZILY_ALLOCATED 2
 
 static VkMemoryHeap memoryHeaps[] =
 {
@@ -52,6 +52,107 @@ VkResult vkCreateShaderModuleFromRpiAssemblyKHR(
 		);
 
 
+//structure types of this driver's own structures, none of these are official extensions
+//the registry gives extension N the types 1000000000 + (N - 1) * 1000 + offset, with N and offset below 1000000 and 1000,
+//so it never reaches 2000000000 and the types from there up to VK_STRUCTURE_TYPE_MAX_ENUM are left to this driver
+#define VK_RPI_STRUCTURE_TYPE_BASE 2000000000
+#define VK_STRUCTURE_TYPE_RPI_QUEUE_THROTTLE_CREATE_INFO ((VkStructureType)(VK_RPI_STRUCTURE_TYPE_BASE + 0))
+
+//limits how far the CPU can run ahead of the GPU on a queue
+//chain to VkDeviceCreateInfo for every queue or to VkDeviceQueueCreateInfo for the queues it creates
+//RPI_VK_MAX_JOBS_IN_FLIGHT and RPI_VK_LATENCY_BUDGET_US override it
+typedef struct VkRpiQueueThrottleCreateInfo {
+	VkStructureType               sType;
+	const void*                   pNext;
+	uint32_t                      maxJobsInFlight; //jobs submitted to the kernel but not finished, 0 keeps the default
+	uint32_t                      latencyBudgetUs; //if set, fewer jobs are allowed in flight so each finishes within this time of being submitted
+} VkRpiQueueThrottleCreateInfo;
+
+//VK_KHR_timeline_semaphore is newer than the bundled vulkan headers, so define it here
+//values match the registry so applications built against newer headers work
+#ifndef VK_KHR_timeline_semaphore
+#define VK_KHR_timeline_semaphore 1
+#define VK_KHR_TIMELINE_SEMAPHORE_SPEC_VERSION 2
+#define VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME "VK_KHR_timeline_semaphore"
+
+#define VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR ((VkStructureType)1000207000)
+#define VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_PROPERTIES_KHR ((VkStructureType)1000207001)
+#define VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO_KHR ((VkStructureType)1000207002)
+#define VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR ((VkStructureType)1000207003)
+#define VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO_KHR ((VkStructureType)1000207004)
+#define VK_STRUCTURE_TYPE_SEMAPHORE_SIGNAL_INFO_KHR ((VkStructureType)1000207005)
+
+typedef enum VkSemaphoreTypeKHR {
+	VK_SEMAPHORE_TYPE_BINARY_KHR = 0,
+	VK_SEMAPHORE_TYPE_TIMELINE_KHR = 1,
+	VK_SEMAPHORE_TYPE_MAX_ENUM_KHR = 0x7FFFFFFF
+} VkSemaphoreTypeKHR;
+
+typedef enum VkSemaphoreWaitFlagBitsKHR {
+	VK_SEMAPHORE_WAIT_ANY_BIT_KHR = 0x00000001,
+	VK_SEMAPHORE_WAIT_FLAG_BITS_MAX_ENUM_KHR = 0x7FFFFFFF
+} VkSemaphoreWaitFlagBitsKHR;
+typedef VkFlags VkSemaphoreWaitFlagsKHR;
+
+typedef struct VkPhysicalDeviceTimelineSemaphoreFeaturesKHR {
+	VkStructureType    sType;
+	void*              pNext;
+	VkBool32           timelineSemaphore;
+} VkPhysicalDeviceTimelineSemaphoreFeaturesKHR;
+
+typedef struct VkPhysicalDeviceTimelineSemaphorePropertiesKHR {
+	VkStructureType    sType;
+	void*              pNext;
+	uint64_t           maxTimelineSemaphoreValueDifference;
+} VkPhysicalDeviceTimelineSemaphorePropertiesKHR;
+
+typedef struct VkSemaphoreTypeCreateInfoKHR {
+	VkStructureType       sType;
+	const void*           pNext;
+	VkSemaphoreTypeKHR    semaphoreType;
+	uint64_t              initialValue;
+} VkSemaphoreTypeCreateInfoKHR;
+
+typedef struct VkTimelineSemaphoreSubmitInfoKHR {
+	VkStructureType    sType;
+	const void*        pNext;
+	uint32_t           waitSemaphoreValueCount;
+	const uint64_t*    pWaitSemaphoreValues;
+	uint32_t           signalSemaphoreValueCount;
+	const uint64_t*    pSignalSemaphoreValues;
+} VkTimelineSemaphoreSubmitInfoKHR;
+
+typedef struct VkSemaphoreWaitInfoKHR {
+	VkStructureType            sType;
+	const void*                pNext;
+	VkSemaphoreWaitFlagsKHR    flags;
+	uint32_t                   semaphoreCount;
+	const VkSemaphore*         pSemaphores;
+	const uint64_t*            pValues;
+} VkSemaphoreWaitInfoKHR;
+
+typedef struct VkSemaphoreSignalInfoKHR {
+	VkStructureType    sType;
+	const void*        pNext;
+	VkSemaphore        semaphore;
+	uint64_t           value;
+} VkSemaphoreSignalInfoKHR;
+
+VkResult vkGetSemaphoreCounterValueKHR(
+		VkDevice                                    device,
+		VkSemaphore                                 semaphore,
+		uint64_t*                                   pValue);
+
+VkResult vkWaitSemaphoresKHR(
+		VkDevice                                    device,
+		const VkSemaphoreWaitInfoKHR*               pWaitInfo,
+		uint64_t                                    timeout);
+
+VkResult vkSignalSemaphoreKHR(
+		VkDevice                                    device,
+		const VkSemaphoreSignalInfoKHR*             pSignalInfo);
+#endif
+
 #ifdef __cplusplus
 }
 #endif
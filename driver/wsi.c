@@ -234,12 +234,20 @@ VKAPI_ATTR VkResult VKAPI_CALL vkCreateSwapchainKHR(
 		s->images[c].tiling = VC4_TILING_FORMAT_T;
 		s->images[c].alignment = mr.alignment;
 
+		//scanout and tiling work on whole BOs, so don't let this share one
+		VkMemoryDedicatedAllocateInfo dedicatedInfo =
+		{
+			.sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_ALLOCATE_INFO,
+			.image = &s->images[c]
+		};
+
 		VkMemoryAllocateInfo ai;
 		ai.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+		ai.pNext = &dedicatedInfo;
 		ai.allocationSize = mr.size;
 		for(int d = 0; d < numMemoryTypes; ++d)
 		{
-			if(memoryTypes[d].propertyFlags == mr.memoryTypeBits)
+			if((mr.memoryTypeBits & (1 << d)) && (memoryTypes[d].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT))
 			{
 				ai.memoryTypeIndex = d;
 				break;
@@ -331,7 +339,7 @@ VKAPI_ATTR VkResult VKAPI_CALL vkAcquireNextImageKHR(
 
 	assert(semaphore != VK_NULL_HANDLE || fence != VK_NULL_HANDLE);
 
-	sem_t* s = semaphore;
+	_semaphore* s = semaphore;
 
 	//TODO we need to keep track of currently acquired images?
 
@@ -340,10 +348,19 @@ VKAPI_ATTR VkResult VKAPI_CALL vkAcquireNextImageKHR(
 	*pImageIndex = ((_swapchain*)swapchain)->backbufferIdx; //return back buffer index
 
 	//signal semaphore
-	int semVal; sem_getvalue(s, &semVal); assert(semVal <= 0); //make sure semaphore is unsignalled
-	sem_post(s);
+	if(s)
+	{
+		semaphoreSignal(s);
+	}
 
-	//TODO signal fence
+	//the image is available right away
+	if(fence)
+	{
+		_fence* f = fence;
+		f->queue = 0;
+		f->seqno = 0;
+		f->signaled = 1;
+	}
 
 	return VK_SUCCESS;
 }
@@ -371,7 +388,7 @@ VKAPI_ATTR VkResult VKAPI_CALL vkQueuePresentKHR(
 	//wait for semaphore in present info set by submit ioctl to make sure cls are flushed
 	for(int c = 0; c < pPresentInfo->waitSemaphoreCount; ++c)
 	{
-		sem_wait((sem_t*)pPresentInfo->pWaitSemaphores[c]);
+		semaphoreWait(pPresentInfo->pWaitSemaphores[c]);
 	}
 
 	for(int c = 0; c < pPresentInfo->swapchainCount; ++c)
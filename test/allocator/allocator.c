@@ -0,0 +1,143 @@
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "driver/ConsecutivePoolAllocator.h"
+
+//Stresses the ConsecutivePoolAllocator the way command buffers use it:
+//every control list starts with one block and grows one block at a time through clFit,
+//then gets freed and allocated again when its command buffer is re-recorded or freed.
+//Block contents are tagged to check that allocations never overlap and that
+//reallocation keeps the data.
+
+#define BLOCK_SIZE 1024
+#define POOL_SIZE (4096 * 128)
+#define NUM_CLS 64
+#define MAX_CL_BLOCKS 16
+#define NUM_OPS 1000000
+
+typedef struct TestCl
+{
+	char* buffer;
+	uint32_t numBlocks;
+} TestCl;
+
+static uint32_t randState = 1;
+
+static uint32_t getRand()
+{
+	randState = randState * 1103515245 + 12345;
+	return randState >> 16;
+}
+
+static double getTimeUs()
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1000000.0 + t.tv_nsec / 1000.0;
+}
+
+static int checkCl(TestCl* cl, uint32_t id)
+{
+	for(uint32_t c = 0; c < cl->numBlocks * BLOCK_SIZE; c += BLOCK_SIZE / 4)
+	{
+		if((uint8_t)cl->buffer[c] != (uint8_t)id)
+		{
+			printf("CL %u corrupted at byte %u\n", id, c);
+			return 0;
+		}
+	}
+	return 1;
+}
+
+int main()
+{
+	char* mem = malloc(POOL_SIZE);
+	ConsecutivePoolAllocator cpa = createConsecutivePoolAllocator(mem, BLOCK_SIZE, POOL_SIZE, 0);
+
+	TestCl cls[NUM_CLS];
+	for(uint32_t c = 0; c < NUM_CLS; ++c)
+	{
+		cls[c].buffer = consecutivePoolAllocate(&cpa, 1);
+		cls[c].numBlocks = 1;
+		memset(cls[c].buffer, c, BLOCK_SIZE);
+	}
+
+	uint32_t numAllocs = 0, numReallocs = 0, numFrees = 0, numFailures = 0;
+	int ok = 1;
+
+	double start = getTimeUs();
+	for(uint32_t op = 0; op < NUM_OPS && ok; ++op)
+	{
+		uint32_t id = getRand() % NUM_CLS;
+		TestCl* cl = &cls[id];
+
+		if(cl->numBlocks < MAX_CL_BLOCKS && getRand() % 4)
+		{
+			//clFit growth
+			char* newBuffer = consecutivePoolReAllocate(&cpa, cl->buffer, cl->numBlocks);
+			numReallocs++;
+			if(!newBuffer)
+			{
+				numFailures++;
+				continue;
+			}
+			cl->buffer = newBuffer;
+			memset(cl->buffer + cl->numBlocks * BLOCK_SIZE, id, BLOCK_SIZE);
+			cl->numBlocks++;
+		}
+		else
+		{
+			//command buffer freed and allocated again
+			consecutivePoolFree(&cpa, cl->buffer, cl->numBlocks);
+			numFrees++;
+			cl->buffer = consecutivePoolAllocate(&cpa, 1);
+			numAllocs++;
+			cl->numBlocks = 1;
+			if(!cl->buffer)
+			{
+				printf("failed to allocate a single block\n");
+				ok = 0;
+				break;
+			}
+			memset(cl->buffer, id, BLOCK_SIZE);
+		}
+
+		ok = checkCl(cl, id);
+	}
+	double elapsedUs = getTimeUs() - start;
+
+	for(uint32_t c = 0; c < NUM_CLS && ok; ++c)
+	{
+		ok = checkCl(&cls[c], c);
+	}
+
+	for(uint32_t c = 0; c < NUM_CLS && ok; ++c)
+	{
+		consecutivePoolFree(&cpa, cls[c].buffer, cls[c].numBlocks);
+	}
+
+	//everything must have merged back, so the whole pool is available again
+	if(ok)
+	{
+		void* all = consecutivePoolAllocate(&cpa, POOL_SIZE / BLOCK_SIZE);
+		if(all != mem)
+		{
+			printf("pool did not coalesce after freeing everything\n");
+			ok = 0;
+		}
+	}
+
+	printf("allocs: %u, reallocs: %u (%u failed, pool full), frees: %u\n", numAllocs, numReallocs, numFailures, numFrees);
+	printf("%.1fns per operation (including checks)\n", elapsedUs * 1000.0 / (numAllocs + numReallocs + numFrees));
+	printf("%s\n", ok ? "passed" : "FAILED");
+
+	destroyConsecutivePoolAllocator(&cpa, 0);
+	free(mem);
+
+	return !ok;
+}
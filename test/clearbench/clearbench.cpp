@@ -0,0 +1,148 @@
+#include <iostream>
+#include <vector>
+#include "driver/CustomAssert.h"
+
+#include "test/common/stubDevice.h"
+
+//Counts the binning work the kernel is asked to do for clears, it does not time anything and reports no Mpixel/s.
+//The kernel is stubbed out by stubDevice.h, which records every submitted job and the size of its bin CL.
+//The stub charges every submit the same and runs no GPU, so both ways of clearing would time the same,
+//the work counted here is what the real kernel and GPU spend the difference on.
+//A job with a bin CL makes the kernel validate it and run a binning pass with its tile state allocation,
+//a job without one skips all of that.
+//The same images are cleared twice over: with vkCmdClearColorImage outside of a render pass,
+//then with render passes that only clear through VK_ATTACHMENT_LOAD_OP_CLEAR.
+
+#define NUM_IMAGES 4
+#define IMAGE_WIDTH 1920
+#define IMAGE_HEIGHT 1080
+#define NUM_FRAMES 200
+
+struct clearStats
+{
+	uint64_t jobs;
+	uint64_t binnedJobs;
+	uint64_t binClBytes;
+};
+
+VkCommandBuffer clearImageCommandBuffer;
+VkCommandBuffer renderPassCommandBuffer;
+VkRenderPass renderPass;
+stubRenderTarget renderTargets[NUM_IMAGES];
+
+void recordCommandBuffers()
+{
+	VkCommandBufferAllocateInfo allocInfo = {};
+	allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	allocInfo.commandPool = commandPool;
+	allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	allocInfo.commandBufferCount = 1;
+	vkAllocateCommandBuffers(device, &allocInfo, &clearImageCommandBuffer);
+	vkAllocateCommandBuffers(device, &allocInfo, &renderPassCommandBuffer);
+
+	VkCommandBufferBeginInfo beginInfo = {};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
+
+	VkClearValue clearValue = {};
+	clearValue.color.float32[0] = 1.0f;
+	clearValue.color.float32[3] = 1.0f;
+
+	VkImageSubresourceRange range = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+
+	vkBeginCommandBuffer(clearImageCommandBuffer, &beginInfo);
+	for(uint32_t c = 0; c < NUM_IMAGES; ++c)
+	{
+		vkCmdClearColorImage(clearImageCommandBuffer, renderTargets[c].image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, &clearValue.color, 1, &range);
+	}
+	vkEndCommandBuffer(clearImageCommandBuffer);
+
+	VkRenderPassBeginInfo renderPassBegin = {};
+	renderPassBegin.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+	renderPassBegin.renderPass = renderPass;
+	renderPassBegin.renderArea.extent = { IMAGE_WIDTH, IMAGE_HEIGHT };
+	renderPassBegin.clearValueCount = 1;
+	renderPassBegin.pClearValues = &clearValue;
+
+	vkBeginCommandBuffer(renderPassCommandBuffer, &beginInfo);
+	for(uint32_t c = 0; c < NUM_IMAGES; ++c)
+	{
+		renderPassBegin.framebuffer = renderTargets[c].framebuffer;
+		vkCmdBeginRenderPass(renderPassCommandBuffer, &renderPassBegin, VK_SUBPASS_CONTENTS_INLINE);
+		vkCmdEndRenderPass(renderPassCommandBuffer);
+	}
+	vkEndCommandBuffer(renderPassCommandBuffer);
+}
+
+void setup()
+{
+	setupDevice();
+
+	renderPass = createClearRenderPass(VK_FORMAT_R8G8B8A8_UNORM);
+	for(uint32_t c = 0; c < NUM_IMAGES; ++c)
+	{
+		renderTargets[c] = createRenderTarget(renderPass, VK_FORMAT_R8G8B8A8_UNORM, IMAGE_WIDTH, IMAGE_HEIGHT,
+											  VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT);
+	}
+
+	recordCommandBuffers();
+}
+
+void cleanup()
+{
+	vkFreeCommandBuffers(device, commandPool, 1, &clearImageCommandBuffer);
+	vkFreeCommandBuffers(device, commandPool, 1, &renderPassCommandBuffer);
+	for(uint32_t c = 0; c < NUM_IMAGES; ++c)
+	{
+		destroyRenderTarget(renderTargets[c]);
+	}
+	vkDestroyRenderPass(device, renderPass, nullptr);
+	cleanupDevice();
+}
+
+//returns the jobs and bin CL bytes the kernel got per frame
+clearStats runFrames(const char* name, VkCommandBuffer commandBuffer)
+{
+	VkSubmitInfo submitInfo = {};
+	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &commandBuffer;
+
+	uint64_t firstSeqno = stubSeqno;
+	uint64_t firstBinClBytes = stubBinClBytes;
+	uint64_t firstBinnedJobs = stubBinnedJobs;
+
+	for(uint32_t f = 0; f < NUM_FRAMES; ++f)
+	{
+		vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE);
+	}
+	vkQueueWaitIdle(queue);
+
+	clearStats stats;
+	stats.jobs = (stubSeqno - firstSeqno) / NUM_FRAMES;
+	stats.binnedJobs = (stubBinnedJobs - firstBinnedJobs) / NUM_FRAMES;
+	stats.binClBytes = (stubBinClBytes - firstBinClBytes) / NUM_FRAMES;
+
+	std::cout << name << ":" << std::endl;
+	std::cout << "  jobs per frame: " << stats.jobs << ", of those binned: " << stats.binnedJobs << std::endl;
+	std::cout << "  bin CL bytes per frame: " << stats.binClBytes << std::endl;
+
+	return stats;
+}
+
+int main()
+{
+	setup();
+
+	std::cout << "frames: " << NUM_FRAMES << ", images cleared per frame: " << NUM_IMAGES << " of " << IMAGE_WIDTH << "x" << IMAGE_HEIGHT << std::endl;
+
+	clearStats clearImage = runFrames("vkCmdClearColorImage", clearImageCommandBuffer);
+	clearStats renderPassClear = runFrames("render pass with VK_ATTACHMENT_LOAD_OP_CLEAR", renderPassCommandBuffer);
+
+	std::cout << "clear-only jobs save per frame: " << renderPassClear.binnedJobs - clearImage.binnedJobs << " binning passes, "
+			  << renderPassClear.binClBytes - clearImage.binClBytes << " bin CL bytes" << std::endl;
+
+	cleanup();
+
+	return 0;
+}
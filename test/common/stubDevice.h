@@ -0,0 +1,296 @@
+#pragma once
+
+#include <iostream>
+#include <chrono>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <vulkan/vulkan.h>
+
+#include <drm/drm.h>
+#include <drm/vc4_drm.h>
+
+//Shared fixture for the tests that run the driver against a stubbed kernel.
+//drmIoctl defined here takes precedence over the one in libdrm, so include this from one source file per test only.
+//Seqno waits complete immediately unless stubHoldJobs is set and every ioctl the stub doesn't know succeeds.
+//Syncobjs are emulated by remembering the seqno of the job whose fence each of them holds.
+
+typedef std::chrono::high_resolution_clock benchClock;
+
+//CPU time every submit burns to stand in for the kernel's work on it
+static uint32_t stubSubmitCostUs = 0;
+
+static std::atomic<uint64_t> stubSeqno(0);
+static std::atomic<uint32_t> stubHandle(0);
+static std::atomic<uint64_t> stubBinClBytes(0);
+static std::atomic<uint64_t> stubBinnedJobs(0);
+
+//while set, only jobs up to stubFinishedSeqno have finished
+static std::atomic<bool> stubHoldJobs(false);
+static std::atomic<uint64_t> stubFinishedSeqno(0);
+
+//fence held by each syncobj: the seqno of its job, 0 if signaled, STUB_NO_FENCE if it has none
+#define STUB_NO_FENCE (~0ull)
+static std::mutex stubSyncobjMutex;
+static std::map<uint32_t, uint64_t> stubSyncobjFences;
+static std::map<int, uint64_t> stubSyncFileFences; //exported fences by file descriptor
+static uint32_t stubLastSyncobj = 0;
+
+static uint64_t stubSyncobjFence(uint32_t syncobj)
+{
+	std::lock_guard<std::mutex> lock(stubSyncobjMutex);
+	auto it = stubSyncobjFences.find(syncobj);
+	return it == stubSyncobjFences.end() ? STUB_NO_FENCE : it->second;
+}
+
+static bool stubJobFinished(uint64_t seqno)
+{
+	return !stubHoldJobs || seqno <= stubFinishedSeqno;
+}
+
+static void burn(uint32_t us)
+{
+	auto end = benchClock::now() + std::chrono::microseconds(us);
+	while(benchClock::now() < end);
+}
+
+extern "C" int drmIoctl(int fd, unsigned long request, void* arg)
+{
+	switch(request)
+	{
+	case DRM_IOCTL_VC4_SUBMIT_CL:
+	{
+		drm_vc4_submit_cl* submit = (drm_vc4_submit_cl*)arg;
+		if(submit->bin_cl_size)
+		{
+			stubBinClBytes += submit->bin_cl_size;
+			stubBinnedJobs++;
+		}
+		burn(stubSubmitCostUs);
+		submit->seqno = ++stubSeqno;
+		if(submit->out_sync)
+		{
+			std::lock_guard<std::mutex> lock(stubSyncobjMutex);
+			stubSyncobjFences[submit->out_sync] = submit->seqno;
+		}
+		return 0;
+	}
+	case DRM_IOCTL_VC4_WAIT_SEQNO:
+	{
+		drm_vc4_wait_seqno* wait = (drm_vc4_wait_seqno*)arg;
+		while(!stubJobFinished(wait->seqno))
+		{
+			if(wait->timeout_ns != ~0ull)
+			{
+				errno = ETIME;
+				return -1;
+			}
+			std::this_thread::sleep_for(std::chrono::microseconds(100));
+		}
+		return 0;
+	}
+	case DRM_IOCTL_GET_CAP:
+	{
+		drm_get_cap* cap = (drm_get_cap*)arg;
+		cap->value = cap->capability == DRM_CAP_SYNCOBJ;
+		return 0;
+	}
+	case DRM_IOCTL_SYNCOBJ_CREATE:
+	{
+		drm_syncobj_create* create = (drm_syncobj_create*)arg;
+		std::lock_guard<std::mutex> lock(stubSyncobjMutex);
+		create->handle = ++stubLastSyncobj;
+		stubSyncobjFences[create->handle] = create->flags & DRM_SYNCOBJ_CREATE_SIGNALED ? 0 : STUB_NO_FENCE;
+		return 0;
+	}
+	case DRM_IOCTL_SYNCOBJ_SIGNAL:
+	case DRM_IOCTL_SYNCOBJ_RESET:
+	{
+		drm_syncobj_array* array = (drm_syncobj_array*)arg;
+		const uint32_t* handles = (const uint32_t*)(uintptr_t)array->handles;
+		std::lock_guard<std::mutex> lock(stubSyncobjMutex);
+		for(uint32_t c = 0; c < array->count_handles; ++c)
+		{
+			stubSyncobjFences[handles[c]] = request == DRM_IOCTL_SYNCOBJ_SIGNAL ? 0 : STUB_NO_FENCE;
+		}
+		return 0;
+	}
+	case DRM_IOCTL_SYNCOBJ_HANDLE_TO_FD:
+	{
+		drm_syncobj_handle* handle = (drm_syncobj_handle*)arg;
+		uint64_t fence = stubSyncobjFence(handle->handle);
+		handle->fd = open("/dev/null", O_RDONLY);
+		std::lock_guard<std::mutex> lock(stubSyncobjMutex);
+		stubSyncFileFences[handle->fd] = fence;
+		return 0;
+	}
+	case DRM_IOCTL_SYNCOBJ_FD_TO_HANDLE:
+	{
+		drm_syncobj_handle* handle = (drm_syncobj_handle*)arg;
+		std::lock_guard<std::mutex> lock(stubSyncobjMutex);
+		stubSyncobjFences[handle->handle] = stubSyncFileFences[handle->fd];
+		return 0;
+	}
+	case DRM_IOCTL_VC4_CREATE_BO:
+		((drm_vc4_create_bo*)arg)->handle = ++stubHandle;
+		return 0;
+	case DRM_IOCTL_VC4_GET_TILING:
+		errno = ENOENT;
+		return -1;
+	default:
+		return 0;
+	}
+}
+
+VkInstance instance;
+VkPhysicalDevice physicalDevice;
+VkDevice device;
+VkQueue queue;
+VkCommandPool commandPool;
+
+struct stubRenderTarget
+{
+	VkImage image;
+	VkDeviceMemory memory;
+	VkImageView view;
+	VkFramebuffer framebuffer;
+};
+
+void setupDevice()
+{
+	VkInstanceCreateInfo instanceInfo = {};
+	instanceInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
+	if(vkCreateInstance(&instanceInfo, nullptr, &instance) != VK_SUCCESS)
+	{
+		std::cerr << "failed to create instance!" << std::endl;
+		exit(-1);
+	}
+
+	uint32_t deviceCount = 1;
+	vkEnumeratePhysicalDevices(instance, &deviceCount, &physicalDevice);
+
+	float queuePriority = 1.0f;
+	VkDeviceQueueCreateInfo queueInfo = {};
+	queueInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+	queueInfo.queueFamilyIndex = 0;
+	queueInfo.queueCount = 1;
+	queueInfo.pQueuePriorities = &queuePriority;
+
+	VkDeviceCreateInfo deviceInfo = {};
+	deviceInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+	deviceInfo.queueCreateInfoCount = 1;
+	deviceInfo.pQueueCreateInfos = &queueInfo;
+	if(vkCreateDevice(physicalDevice, &deviceInfo, nullptr, &device) != VK_SUCCESS)
+	{
+		std::cerr << "failed to create device!" << std::endl;
+		exit(-1);
+	}
+
+	vkGetDeviceQueue(device, 0, 0, &queue);
+
+	VkCommandPoolCreateInfo poolInfo = {};
+	poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	poolInfo.queueFamilyIndex = 0;
+	vkCreateCommandPool(device, &poolInfo, nullptr, &commandPool);
+}
+
+void cleanupDevice()
+{
+	vkDestroyCommandPool(device, commandPool, nullptr);
+	vkDestroyDevice(device, nullptr);
+	vkDestroyInstance(instance, nullptr);
+}
+
+//a single subpass render pass that clears and stores one color attachment
+VkRenderPass createClearRenderPass(VkFormat format)
+{
+	VkAttachmentDescription attachment = {};
+	attachment.format = format;
+	attachment.samples = VK_SAMPLE_COUNT_1_BIT;
+	attachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+	attachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+	attachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+	attachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	attachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	attachment.finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+	VkAttachmentReference colorRef = { 0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL };
+
+	VkSubpassDescription subpass = {};
+	subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+	subpass.colorAttachmentCount = 1;
+	subpass.pColorAttachments = &colorRef;
+
+	VkRenderPassCreateInfo renderPassInfo = {};
+	renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+	renderPassInfo.attachmentCount = 1;
+	renderPassInfo.pAttachments = &attachment;
+	renderPassInfo.subpassCount = 1;
+	renderPassInfo.pSubpasses = &subpass;
+
+	VkRenderPass renderPass;
+	vkCreateRenderPass(device, &renderPassInfo, nullptr, &renderPass);
+	return renderPass;
+}
+
+//a color image with its memory, view and a framebuffer compatible with renderPass
+stubRenderTarget createRenderTarget(VkRenderPass renderPass, VkFormat format, uint32_t width, uint32_t height, VkImageUsageFlags usage)
+{
+	stubRenderTarget rt;
+
+	VkImageCreateInfo imageInfo = {};
+	imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+	imageInfo.imageType = VK_IMAGE_TYPE_2D;
+	imageInfo.format = format;
+	imageInfo.extent = { width, height, 1 };
+	imageInfo.mipLevels = 1;
+	imageInfo.arrayLayers = 1;
+	imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+	imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+	imageInfo.usage = usage;
+	vkCreateImage(device, &imageInfo, nullptr, &rt.image);
+
+	VkMemoryRequirements memReqs;
+	vkGetImageMemoryRequirements(device, rt.image, &memReqs);
+
+	VkMemoryAllocateInfo memInfo = {};
+	memInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	memInfo.allocationSize = memReqs.size;
+	memInfo.memoryTypeIndex = 0;
+	vkAllocateMemory(device, &memInfo, nullptr, &rt.memory);
+	vkBindImageMemory(device, rt.image, rt.memory, 0);
+
+	VkImageViewCreateInfo viewInfo = {};
+	viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+	viewInfo.image = rt.image;
+	viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+	viewInfo.format = format;
+	viewInfo.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+	vkCreateImageView(device, &viewInfo, nullptr, &rt.view);
+
+	VkFramebufferCreateInfo framebufferInfo = {};
+	framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+	framebufferInfo.renderPass = renderPass;
+	framebufferInfo.attachmentCount = 1;
+	framebufferInfo.pAttachments = &rt.view;
+	framebufferInfo.width = width;
+	framebufferInfo.height = height;
+	framebufferInfo.layers = 1;
+	vkCreateFramebuffer(device, &framebufferInfo, nullptr, &rt.framebuffer);
+
+	return rt;
+}
+
+void destroyRenderTarget(const stubRenderTarget& rt)
+{
+	vkDestroyFramebuffer(device, rt.framebuffer, nullptr);
+	vkDestroyImageView(device, rt.view, nullptr);
+	vkDestroyImage(device, rt.image, nullptr);
+	vkFreeMemory(device, rt.memory, nullptr);
+}
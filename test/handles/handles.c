@@ -0,0 +1,96 @@
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "driver/ControlListUtil.h"
+
+//Records the BO handle relocations of NUM_DRAWS draws, each referencing HANDLES_PER_DRAW BOs
+//out of NUM_BOS distinct ones, through clGetHandleIndex and through the old linear scan.
+
+#define NUM_DRAWS 10000
+#define NUM_BOS 500
+#define HANDLES_PER_DRAW 4 //fragment, vertex, coordinate shader code and a vertex buffer
+#define NUM_RUNS 10
+
+//handle lookup as it was before the hash
+static uint32_t linearGetHandleIndex(ControlList* handlesCl, uint32_t handle)
+{
+	uint32_t c = 0;
+
+	uint32_t numHandles = clSize(handlesCl) / 4;
+
+	for(; c < numHandles; ++c)
+	{
+		if(((uint32_t*)handlesCl->buffer)[c] == handle)
+		{
+			return c;
+		}
+	}
+
+	*(uint32_t*)handlesCl->nextFreeByte = handle;
+	handlesCl->nextFreeByte += 4;
+
+	return c;
+}
+
+static double getTimeUs()
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1000000.0 + t.tv_nsec / 1000.0;
+}
+
+//handle of the d-th BO referenced by draw c, GEM handles start at 1
+static uint32_t getHandle(uint32_t c, uint32_t d)
+{
+	return 1 + (c * HANDLES_PER_DRAW + d) * 7 % NUM_BOS;
+}
+
+int main()
+{
+	void* buffer = malloc(NUM_BOS * 4);
+	ControlListHandleHash* hash = malloc(sizeof(ControlListHandleHash));
+	ControlList handlesCl;
+
+	double linearUs = 0, hashUs = 0;
+	uint32_t checksum = 0;
+
+	for(uint32_t r = 0; r < NUM_RUNS; ++r)
+	{
+		clInit(&handlesCl, buffer);
+		double start = getTimeUs();
+		for(uint32_t c = 0; c < NUM_DRAWS; ++c)
+		{
+			for(uint32_t d = 0; d < HANDLES_PER_DRAW; ++d)
+			{
+				checksum += linearGetHandleIndex(&handlesCl, getHandle(c, d));
+			}
+		}
+		linearUs += getTimeUs() - start;
+
+		clInit(&handlesCl, buffer);
+		clInitHandleHash(hash);
+		start = getTimeUs();
+		for(uint32_t c = 0; c < NUM_DRAWS; ++c)
+		{
+			for(uint32_t d = 0; d < HANDLES_PER_DRAW; ++d)
+			{
+				checksum -= clGetHandleIndex(&handlesCl, hash, getHandle(c, d));
+			}
+		}
+		hashUs += getTimeUs() - start;
+	}
+
+	printf("draws: %u, distinct BOs: %u, handles per draw: %u\n", NUM_DRAWS, NUM_BOS, HANDLES_PER_DRAW);
+	printf("linear scan: %.1fus per command buffer\n", linearUs / NUM_RUNS);
+	printf("hash: %.1fus per command buffer\n", hashUs / NUM_RUNS);
+	printf("%s\n", checksum ? "MISMATCH between linear and hashed indices" : "indices match");
+
+	free(hash);
+	free(buffer);
+
+	return checksum != 0;
+}
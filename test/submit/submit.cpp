@@ -0,0 +1,238 @@
+#include <iostream>
+#include <vector>
+#include "driver/CustomAssert.h"
+
+#include "test/common/stubDevice.h"
+#include "driver/vkExt.h"
+
+//Measures how long vkQueueSubmit blocks the calling thread.
+//The kernel is stubbed out by stubDevice.h, every submit burns a fixed amount of CPU time
+//to stand in for the kernel's CL validation.
+//Each frame submits a few command buffers, then the app does some CPU work of its own
+//that the submission can overlap with.
+//The frame is submitted twice over: with one vkQueueSubmit per command buffer,
+//then with a single vkQueueSubmit carrying one batch per command buffer.
+//Before that it checks that no signal semaphore of a batch is signaled before the batch's jobs finish.
+
+#define NUM_COMMAND_BUFFERS 4
+#define NUM_FRAMES 1000
+#define SUBMIT_COST_US 50
+#define APP_WORK_US 300
+
+VkCommandBuffer commandBuffers[NUM_COMMAND_BUFFERS];
+VkRenderPass renderPass;
+stubRenderTarget renderTarget;
+
+void setup()
+{
+	stubSubmitCostUs = SUBMIT_COST_US;
+
+	setupDevice();
+
+	VkCommandBufferAllocateInfo allocInfo = {};
+	allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	allocInfo.commandPool = commandPool;
+	allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	allocInfo.commandBufferCount = NUM_COMMAND_BUFFERS;
+	vkAllocateCommandBuffers(device, &allocInfo, commandBuffers);
+
+	VkCommandBufferBeginInfo beginInfo = {};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
+
+	//a small render pass so every command buffer turns into one kernel submit
+	renderPass = createClearRenderPass(VK_FORMAT_R8G8B8A8_UNORM);
+	renderTarget = createRenderTarget(renderPass, VK_FORMAT_R8G8B8A8_UNORM, 64, 64, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT);
+
+	VkClearValue clearValue = {};
+
+	VkRenderPassBeginInfo renderPassBegin = {};
+	renderPassBegin.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+	renderPassBegin.renderPass = renderPass;
+	renderPassBegin.framebuffer = renderTarget.framebuffer;
+	renderPassBegin.renderArea.extent = { 64, 64 };
+	renderPassBegin.clearValueCount = 1;
+	renderPassBegin.pClearValues = &clearValue;
+
+	for(uint32_t c = 0; c < NUM_COMMAND_BUFFERS; ++c)
+	{
+		vkBeginCommandBuffer(commandBuffers[c], &beginInfo);
+		vkCmdBeginRenderPass(commandBuffers[c], &renderPassBegin, VK_SUBPASS_CONTENTS_INLINE);
+		vkCmdEndRenderPass(commandBuffers[c]);
+		vkEndCommandBuffer(commandBuffers[c]);
+	}
+}
+
+void cleanup()
+{
+	vkFreeCommandBuffers(device, commandPool, NUM_COMMAND_BUFFERS, commandBuffers);
+	destroyRenderTarget(renderTarget);
+	vkDestroyRenderPass(device, renderPass, nullptr);
+	cleanupDevice();
+}
+
+//a binary semaphore and the syncobj backing it
+VkSemaphore createBinarySemaphore(uint32_t* syncobj)
+{
+	VkSemaphoreCreateInfo semaphoreInfo = {};
+	semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+	VkSemaphore semaphore;
+	vkCreateSemaphore(device, &semaphoreInfo, nullptr, &semaphore);
+	*syncobj = stubLastSyncobj;
+	return semaphore;
+}
+
+//submits the batch while no job finishes, then checks that syncobj holds the fence of the last job submitted
+bool checkSignaledAfterJobs(const char* name, const VkSubmitInfo* submitInfos, uint32_t submitCount, uint32_t syncobj)
+{
+	stubHoldJobs = true;
+	stubFinishedSeqno = (uint64_t)stubSeqno;
+
+	//as if the fence of an earlier submit was waited on already
+	{
+		std::lock_guard<std::mutex> lock(stubSyncobjMutex);
+		stubSyncobjFences[syncobj] = STUB_NO_FENCE;
+	}
+
+	vkQueueSubmit(queue, submitCount, submitInfos, VK_NULL_HANDLE);
+
+	//the submit thread hands the semaphore its fence once it got to it
+	auto end = benchClock::now() + std::chrono::seconds(1);
+	while(stubSyncobjFence(syncobj) == STUB_NO_FENCE && benchClock::now() < end)
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+
+	uint64_t fence = stubSyncobjFence(syncobj);
+	bool ok = fence == stubSeqno && fence > stubFinishedSeqno;
+
+	std::cout << name << ": " << (ok ? "signaled with the last job" : "signaled before the jobs finished") << std::endl;
+
+	stubHoldJobs = false;
+	vkQueueWaitIdle(queue);
+
+	return ok;
+}
+
+bool checkSignalOrder()
+{
+	uint32_t firstSyncobj, secondSyncobj;
+	VkSemaphore binarySemaphores[2];
+	binarySemaphores[0] = createBinarySemaphore(&firstSyncobj);
+	binarySemaphores[1] = createBinarySemaphore(&secondSyncobj);
+
+	VkSemaphoreTypeCreateInfoKHR timelineTypeInfo = {};
+	timelineTypeInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO_KHR;
+	timelineTypeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE_KHR;
+
+	VkSemaphoreCreateInfo timelineInfo = {};
+	timelineInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+	timelineInfo.pNext = &timelineTypeInfo;
+
+	VkSemaphore timelineSemaphore;
+	vkCreateSemaphore(device, &timelineInfo, nullptr, &timelineSemaphore);
+
+	bool ok = true;
+
+	VkSubmitInfo submitInfos[2] = {};
+	submitInfos[0].sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfos[0].commandBufferCount = 1;
+	submitInfos[0].pCommandBuffers = &commandBuffers[0];
+	submitInfos[0].signalSemaphoreCount = 2;
+	submitInfos[0].pSignalSemaphores = binarySemaphores;
+	ok &= checkSignaledAfterJobs("second of two signal semaphores", submitInfos, 1, secondSyncobj);
+
+	uint64_t timelineValues[2] = { 1, 0 };
+	VkTimelineSemaphoreSubmitInfoKHR timelineSubmitInfo = {};
+	timelineSubmitInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR;
+	timelineSubmitInfo.signalSemaphoreValueCount = 2;
+	timelineSubmitInfo.pSignalSemaphoreValues = timelineValues;
+
+	VkSemaphore mixedSemaphores[2] = { timelineSemaphore, binarySemaphores[1] };
+	submitInfos[0].pNext = &timelineSubmitInfo;
+	submitInfos[0].pSignalSemaphores = mixedSemaphores;
+	ok &= checkSignaledAfterJobs("binary signal semaphore after a timeline one", submitInfos, 1, secondSyncobj);
+
+	submitInfos[0].pNext = nullptr;
+	submitInfos[0].signalSemaphoreCount = 0;
+	submitInfos[1].sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfos[1].signalSemaphoreCount = 1;
+	submitInfos[1].pSignalSemaphores = &binarySemaphores[1];
+	ok &= checkSignaledAfterJobs("signal semaphore of a batch without jobs", submitInfos, 2, secondSyncobj);
+
+	vkDestroySemaphore(device, timelineSemaphore, nullptr);
+	vkDestroySemaphore(device, binarySemaphores[1], nullptr);
+	vkDestroySemaphore(device, binarySemaphores[0], nullptr);
+
+	return ok;
+}
+
+//returns the app thread time spent in vkQueueSubmit per frame
+double runFrames(bool batched)
+{
+	VkSubmitInfo submitInfos[NUM_COMMAND_BUFFERS] = {};
+	for(uint32_t c = 0; c < NUM_COMMAND_BUFFERS; ++c)
+	{
+		submitInfos[c].sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		submitInfos[c].commandBufferCount = 1;
+		submitInfos[c].pCommandBuffers = &commandBuffers[c];
+	}
+
+	uint64_t firstSeqno = stubSeqno;
+	double submitUs = 0;
+
+	auto start = benchClock::now();
+	for(uint32_t f = 0; f < NUM_FRAMES; ++f)
+	{
+		auto frameStart = benchClock::now();
+		if(batched)
+		{
+			vkQueueSubmit(queue, NUM_COMMAND_BUFFERS, submitInfos, VK_NULL_HANDLE);
+		}
+		else
+		{
+			for(uint32_t c = 0; c < NUM_COMMAND_BUFFERS; ++c)
+			{
+				vkQueueSubmit(queue, 1, &submitInfos[c], VK_NULL_HANDLE);
+			}
+		}
+		submitUs += std::chrono::duration<double, std::micro>(benchClock::now() - frameStart).count();
+
+		burn(APP_WORK_US);
+	}
+	vkQueueWaitIdle(queue);
+	auto end = benchClock::now();
+
+	double totalUs = std::chrono::duration<double, std::micro>(end - start).count();
+
+	std::cout << (batched ? "1 call with " : "") << NUM_COMMAND_BUFFERS << (batched ? " batches" : " calls") << " per frame:" << std::endl;
+	std::cout << "  app thread time in vkQueueSubmit per frame: " << submitUs / NUM_FRAMES << "us" << std::endl;
+	std::cout << "  frame time: " << totalUs / NUM_FRAMES << "us" << std::endl;
+	std::cout << "  ioctls issued: " << stubSeqno - firstSeqno << std::endl;
+
+	return submitUs / NUM_FRAMES;
+}
+
+int main()
+{
+	setup();
+
+	if(!checkSignalOrder())
+	{
+		cleanup();
+		return -1;
+	}
+
+	std::cout << "frames: " << NUM_FRAMES << ", command buffers per frame: " << NUM_COMMAND_BUFFERS << std::endl;
+	std::cout << "simulated kernel cost per submit: " << SUBMIT_COST_US << "us, app work per frame: " << APP_WORK_US << "us" << std::endl;
+
+	double callsUs = runFrames(false);
+	double batchesUs = runFrames(true);
+
+	std::cout << "batched submit speedup: " << callsUs / batchesUs << "x" << std::endl;
+
+	cleanup();
+
+	return 0;
+}